@@ -0,0 +1,139 @@
+#pragma once
+
+#include "opentelemetry/common/key_value_iterable.h"
+#include "opentelemetry/sdk/metrics/view/attributes_processor.h"
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace bmctelemetry
+{
+
+/**
+ * Which attribute keys a view keeps. Measurements that differ only in
+ * dropped keys aggregate into the same cell.
+ */
+class AttributeFilter
+{
+  public:
+    using Predicate = std::function<bool(std::string_view)>;
+
+    /**
+     * Keep every key
+     */
+    AttributeFilter() = default;
+
+    /**
+     * Keep only `keys`
+     */
+    static AttributeFilter allow(std::vector<std::string> keys)
+    {
+        return AttributeFilter(Mode::Allow, std::move(keys), {});
+    }
+    /**
+     * Keep every key except `keys`
+     */
+    static AttributeFilter deny(std::vector<std::string> keys)
+    {
+        return AttributeFilter(Mode::Deny, std::move(keys), {});
+    }
+    /**
+     * Keep the keys for which `keep` returns true
+     */
+    static AttributeFilter matching(Predicate keep)
+    {
+        return AttributeFilter(Mode::Predicate, {}, std::move(keep));
+    }
+
+    bool keepsAll() const noexcept
+    {
+        return mode_ == Mode::All;
+    }
+
+    bool keeps(std::string_view key) const
+    {
+        switch (mode_)
+        {
+            case Mode::All:
+                return true;
+            case Mode::Allow:
+                return listed(key);
+            case Mode::Deny:
+                return !listed(key);
+            case Mode::Predicate:
+                return keep_(key);
+        }
+        return true;
+    }
+
+  private:
+    enum class Mode
+    {
+        All,
+        Allow,
+        Deny,
+        Predicate,
+    };
+
+    AttributeFilter(Mode mode, std::vector<std::string> keys, Predicate keep) :
+        mode_(mode), keys_(std::move(keys)), keep_(std::move(keep))
+    {
+        std::sort(keys_.begin(), keys_.end());
+    }
+
+    bool listed(std::string_view key) const
+    {
+        return std::binary_search(keys_.begin(), keys_.end(), key);
+    }
+
+    Mode mode_ = Mode::All;
+    // Sorted
+    std::vector<std::string> keys_;
+    Predicate keep_;
+};
+
+/**
+ * Attributes processor applying an AttributeFilter before aggregation.
+ * Depending on the SDK version, sync storage either calls process() or
+ * hashes the measurement attributes through isPresent(); both apply the
+ * same filter.
+ */
+class FilteringAttributesProcessor final :
+    public opentelemetry::sdk::metrics::AttributesProcessor
+{
+  public:
+    explicit FilteringAttributesProcessor(AttributeFilter filter) :
+        filter_(std::move(filter))
+    {}
+
+    opentelemetry::sdk::metrics::MetricAttributes
+        process(const opentelemetry::common::KeyValueIterable& attributes)
+            const noexcept override
+    {
+        opentelemetry::sdk::metrics::MetricAttributes result;
+        attributes.ForEachKeyValue(
+            [&](opentelemetry::nostd::string_view key,
+                opentelemetry::common::AttributeValue value) noexcept {
+            if (filter_.keeps(std::string_view(key.data(), key.size())))
+            {
+                result.SetAttribute(key, value);
+            }
+            return true;
+        });
+        return result;
+    }
+
+    bool isPresent(opentelemetry::nostd::string_view key) const noexcept override
+    {
+        return filter_.keeps(std::string_view(key.data(), key.size()));
+    }
+
+  private:
+    AttributeFilter filter_;
+};
+
+} // namespace bmctelemetry
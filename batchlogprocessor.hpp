@@ -0,0 +1,90 @@
+#pragma once
+
+#include "opentelemetry/nostd/span.h"
+#include "opentelemetry/sdk/logs/exporter.h"
+#include "opentelemetry/sdk/logs/processor.h"
+
+#include "batchprocessor.hpp"
+
+#include <memory>
+
+namespace bmctelemetry
+{
+
+/**
+ * Log record processor that hands emitted records to a background thread
+ * for export, so a logging burst never waits on the exporter. What happens
+ * when the queue is full is decided by BatchProcessorOptions::overflow.
+ */
+class LockFreeBatchLogRecordProcessor final :
+    public opentelemetry::sdk::logs::LogRecordProcessor
+{
+    using Recordable = opentelemetry::sdk::logs::Recordable;
+
+  public:
+    LockFreeBatchLogRecordProcessor(
+        std::unique_ptr<opentelemetry::sdk::logs::LogRecordExporter> exporter,
+        const BatchProcessorOptions& options = {}) :
+        exporter_(std::move(exporter)),
+        worker_(options, [this](std::vector<std::unique_ptr<Recordable>>&
+                                    batch) {
+            exporter_->Export(opentelemetry::nostd::span<
+                              std::unique_ptr<Recordable>>(batch.data(),
+                                                           batch.size()));
+        })
+    {}
+    ~LockFreeBatchLogRecordProcessor() override
+    {
+        Shutdown();
+    }
+
+    std::unique_ptr<Recordable> MakeRecordable() noexcept override
+    {
+        return exporter_->MakeRecordable();
+    }
+
+    void OnEmit(std::unique_ptr<Recordable>&& record) noexcept override
+    {
+        worker_.enqueue(std::move(record));
+    }
+
+    bool ForceFlush(std::chrono::microseconds timeout =
+                        (std::chrono::microseconds::max)()) noexcept override
+    {
+        if (!worker_.forceFlush(timeout))
+        {
+            return false;
+        }
+        return exporter_->ForceFlush(timeout);
+    }
+
+    bool Shutdown(std::chrono::microseconds timeout =
+                      (std::chrono::microseconds::max)()) noexcept override
+    {
+        // The exporter is only shut down once the worker stopped using it
+        if (!worker_.shutdown(timeout))
+        {
+            return false;
+        }
+        if (is_shutdown_.exchange(true))
+        {
+            return true;
+        }
+        return exporter_->Shutdown(timeout);
+    }
+
+    /**
+     * Number of records queued, exported and dropped on overflow
+     */
+    BatchStats stats() const noexcept
+    {
+        return worker_.stats();
+    }
+
+  private:
+    std::unique_ptr<opentelemetry::sdk::logs::LogRecordExporter> exporter_;
+    BatchWorker<std::unique_ptr<Recordable>> worker_;
+    std::atomic<bool> is_shutdown_{false};
+};
+
+} // namespace bmctelemetry
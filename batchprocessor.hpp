@@ -0,0 +1,321 @@
+#pragma once
+
+#include "lockfreequeue.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace bmctelemetry
+{
+
+/**
+ * What a producer does when the batch queue is full
+ */
+enum class OverflowPolicy
+{
+    // Drop the record being queued
+    DropNewest,
+    // Drop the oldest queued record to make room
+    DropOldest,
+    // Wait up to block_timeout for room, then drop the record being queued
+    Block,
+};
+
+/**
+ * Struct to hold batch processor options.
+ */
+struct BatchProcessorOptions
+{
+    // Records held in the queue; records beyond this are dropped
+    std::size_t max_queue_size = 2048;
+    // Records handed to the exporter per call
+    std::size_t max_export_batch_size = 512;
+    // Longest time a record waits in the queue before it is exported
+    std::chrono::milliseconds schedule_delay = std::chrono::milliseconds(5000);
+    OverflowPolicy overflow = OverflowPolicy::DropNewest;
+    // Only used with OverflowPolicy::Block
+    std::chrono::milliseconds block_timeout = std::chrono::milliseconds(100);
+};
+
+/**
+ * Counters kept by BatchWorker
+ */
+struct BatchStats
+{
+    std::uint64_t enqueued = 0;
+    std::uint64_t exported = 0;
+    std::uint64_t dropped = 0;
+};
+
+/**
+ * Queue plus background thread shared by the batching span and log
+ * processors.
+ *
+ * Producers only push into a BoundedQueue. What happens when it is full is
+ * decided by the OverflowPolicy; every record that is dropped is counted.
+ * The worker thread wakes up when a
+ * batch worth of records is queued, when schedule_delay expires, or on
+ * flush/shutdown, and hands batches of up to max_export_batch_size records
+ * to the export callback.
+ */
+template <typename T>
+class BatchWorker
+{
+  public:
+    using ExportFn = std::function<void(std::vector<T>&)>;
+
+    BatchWorker(const BatchProcessorOptions& options, ExportFn exportFn) :
+        options_(options), queue_(options.max_queue_size),
+        export_(std::move(exportFn))
+    {
+        batch_.reserve(options_.max_export_batch_size);
+        worker_ = std::thread([this] { run(); });
+    }
+    BatchWorker(const BatchWorker&) = delete;
+    BatchWorker& operator=(const BatchWorker&) = delete;
+    ~BatchWorker()
+    {
+        shutdown();
+    }
+
+    /**
+     * Queue a record. Only waits for room with OverflowPolicy::Block.
+     *
+     * @return false if the record was dropped
+     */
+    bool enqueue(T&& record) noexcept
+    {
+        if (stopping_.load(std::memory_order_relaxed))
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (!queue_.tryPush(std::move(record)) && !enqueueFull(record))
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        enqueued_.fetch_add(1, std::memory_order_relaxed);
+        if (queue_.sizeApprox() >= options_.max_export_batch_size &&
+            !wake_pending_.exchange(true, std::memory_order_relaxed))
+        {
+            // Taking the lock orders the push before the worker's predicate
+            // check, so it cannot miss this wakeup and sleep a whole
+            // schedule_delay
+            std::lock_guard<std::mutex> lock(mutex_);
+            wake_.notify_one();
+        }
+        return true;
+    }
+
+    /**
+     * Export everything queued so far
+     *
+     * @return false if the worker did not finish within `timeout`
+     */
+    bool forceFlush(std::chrono::microseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!worker_.joinable())
+        {
+            return true;
+        }
+        const auto target = ++flush_requested_;
+        wake_.notify_one();
+        auto flushed = [this, target] {
+            return finished_ || flush_completed_ >= target;
+        };
+        if (timeout == (std::chrono::microseconds::max)())
+        {
+            flushed_.wait(lock, flushed);
+            return true;
+        }
+        return flushed_.wait_for(lock, timeout, flushed);
+    }
+
+    /**
+     * Export everything queued and stop the worker thread. The thread is
+     * only joined once it has finished; if it is still exporting when
+     * `timeout` expires it keeps running, and a later call or the
+     * destructor joins it. It uses this object, so it is never detached.
+     *
+     * @return false if the worker did not finish within `timeout`
+     */
+    bool shutdown(std::chrono::microseconds timeout =
+                      (std::chrono::microseconds::max)())
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        stopping_.store(true);
+        wake_.notify_one();
+        auto finished = [this] { return finished_; };
+        if (timeout == (std::chrono::microseconds::max)())
+        {
+            flushed_.wait(lock, finished);
+        }
+        else if (!flushed_.wait_for(lock, timeout, finished))
+        {
+            return false;
+        }
+        std::thread worker = std::move(worker_);
+        lock.unlock();
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+        return true;
+    }
+
+    BatchStats stats() const noexcept
+    {
+        return BatchStats{enqueued_.load(std::memory_order_relaxed),
+                          exported_.load(std::memory_order_relaxed),
+                          dropped_.load(std::memory_order_relaxed)};
+    }
+
+  private:
+    // Slow path of enqueue once the queue has been found full
+    bool enqueueFull(T& record) noexcept
+    {
+        switch (options_.overflow)
+        {
+            case OverflowPolicy::DropNewest:
+                return false;
+            case OverflowPolicy::DropOldest:
+            {
+                T oldest;
+                for (std::size_t i = 0; i < queue_.capacity(); ++i)
+                {
+                    if (queue_.tryPop(oldest))
+                    {
+                        dropped_.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    if (queue_.tryPush(std::move(record)))
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+            case OverflowPolicy::Block:
+            {
+                const auto deadline = std::chrono::steady_clock::now() +
+                                      options_.block_timeout;
+                blocked_.fetch_add(1);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                bool pushed = false;
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.notify_one();
+                while (!(pushed = queue_.tryPush(std::move(record))) &&
+                       !stopping_.load())
+                {
+                    if (space_.wait_until(lock, deadline) ==
+                            std::cv_status::timeout &&
+                        !(pushed = queue_.tryPush(std::move(record))))
+                    {
+                        break;
+                    }
+                }
+                blocked_.fetch_sub(1);
+                return pushed;
+            }
+        }
+        return false;
+    }
+
+    void run()
+    {
+        for (;;)
+        {
+            std::uint64_t flush_target = 0;
+            bool stopping = false;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait_for(lock, options_.schedule_delay, [this] {
+                    return stopping_.load() ||
+                           flush_requested_ != flush_completed_ ||
+                           queue_.sizeApprox() >=
+                               options_.max_export_batch_size;
+                });
+                wake_pending_.store(false, std::memory_order_relaxed);
+                flush_target = flush_requested_;
+                stopping = stopping_.load();
+            }
+
+            drain();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                flush_completed_ = flush_target;
+            }
+            flushed_.notify_all();
+            if (stopping)
+            {
+                // Records pushed while stopping was being set
+                drain();
+                std::lock_guard<std::mutex> lock(mutex_);
+                flush_completed_ = flush_requested_;
+                finished_ = true;
+                flushed_.notify_all();
+                return;
+            }
+        }
+    }
+
+    void drain()
+    {
+        T record;
+        for (;;)
+        {
+            while (batch_.size() < options_.max_export_batch_size &&
+                   queue_.tryPop(record))
+            {
+                batch_.push_back(std::move(record));
+            }
+            if (batch_.empty())
+            {
+                return;
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (blocked_.load(std::memory_order_relaxed) != 0)
+            {
+                // Producers wait with mutex_ held until they sleep on space_
+                std::lock_guard<std::mutex> lock(mutex_);
+                space_.notify_all();
+            }
+            exported_.fetch_add(batch_.size(), std::memory_order_relaxed);
+            export_(batch_);
+            batch_.clear();
+        }
+    }
+
+    BatchProcessorOptions options_;
+    BoundedQueue<T> queue_;
+    ExportFn export_;
+    std::vector<T> batch_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable flushed_;
+    std::condition_variable space_;
+    std::atomic<std::size_t> blocked_{0};
+    std::atomic<bool> wake_pending_{false};
+    std::atomic<bool> stopping_{false};
+    std::uint64_t flush_requested_ = 0;
+    std::uint64_t flush_completed_ = 0;
+    // Set by the worker thread right before it returns
+    bool finished_ = false;
+
+    std::atomic<std::uint64_t> enqueued_{0};
+    std::atomic<std::uint64_t> exported_{0};
+    std::atomic<std::uint64_t> dropped_{0};
+
+    std::thread worker_;
+};
+
+} // namespace bmctelemetry
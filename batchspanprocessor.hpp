@@ -0,0 +1,94 @@
+#pragma once
+
+#include "opentelemetry/nostd/span.h"
+#include "opentelemetry/sdk/trace/exporter.h"
+#include "opentelemetry/sdk/trace/processor.h"
+
+#include "batchprocessor.hpp"
+
+#include <memory>
+
+namespace bmctelemetry
+{
+
+/**
+ * Span processor that hands finished spans to a background thread for
+ * export. Ending a span only pushes it into a lock free queue; when the queue
+ * is full the span is dropped and counted.
+ */
+class LockFreeBatchSpanProcessor final :
+    public opentelemetry::sdk::trace::SpanProcessor
+{
+    using Recordable = opentelemetry::sdk::trace::Recordable;
+
+  public:
+    LockFreeBatchSpanProcessor(
+        std::unique_ptr<opentelemetry::sdk::trace::SpanExporter> exporter,
+        const BatchProcessorOptions& options = {}) :
+        exporter_(std::move(exporter)),
+        worker_(options, [this](std::vector<std::unique_ptr<Recordable>>&
+                                    batch) {
+            exporter_->Export(opentelemetry::nostd::span<
+                              std::unique_ptr<Recordable>>(batch.data(),
+                                                           batch.size()));
+        })
+    {}
+    ~LockFreeBatchSpanProcessor() override
+    {
+        Shutdown();
+    }
+
+    std::unique_ptr<Recordable> MakeRecordable() noexcept override
+    {
+        return exporter_->MakeRecordable();
+    }
+
+    void OnStart(Recordable&,
+                 const opentelemetry::trace::SpanContext&) noexcept override
+    {}
+
+    void OnEnd(std::unique_ptr<Recordable>&& span) noexcept override
+    {
+        worker_.enqueue(std::move(span));
+    }
+
+    bool ForceFlush(std::chrono::microseconds timeout =
+                        (std::chrono::microseconds::max)()) noexcept override
+    {
+        if (!worker_.forceFlush(timeout))
+        {
+            return false;
+        }
+        return exporter_->ForceFlush(timeout);
+    }
+
+    bool Shutdown(std::chrono::microseconds timeout =
+                      (std::chrono::microseconds::max)()) noexcept override
+    {
+        // The exporter is only shut down once the worker stopped using it
+        if (!worker_.shutdown(timeout))
+        {
+            return false;
+        }
+        if (is_shutdown_.exchange(true))
+        {
+            return true;
+        }
+        return exporter_->Shutdown(timeout);
+    }
+
+    /**
+     * Number of spans queued, exported and dropped because the queue was full
+     */
+    BatchStats stats() const noexcept
+    {
+        return worker_.stats();
+    }
+
+  private:
+    std::unique_ptr<opentelemetry::sdk::trace::SpanExporter> exporter_;
+    BatchWorker<std::unique_ptr<Recordable>> worker_;
+    std::atomic<bool> is_shutdown_{false};
+};
+
+} // namespace bmctelemetry
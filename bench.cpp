@@ -0,0 +1,1177 @@
+// Microbenchmarks for the telemetry hot paths: metric translation and
+// serialization, span creation, the batch span processor and the metric
+// instruments. Built by the `bench` target and run by `meson test
+// --benchmark`; every row reports ns per operation and heap allocations per
+// operation (or per series where the operation covers a whole payload).
+
+constexpr const char* libraryname = "otelbench";
+#include "otelapi.hpp"
+#include "opentelemetry/sdk/metrics/metric_reader.h"
+#include "opentelemetry/sdk/trace/span_data.h"
+#include "opentelemetry/trace/noop.h"
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace
+{
+// Allocations made by the current thread
+thread_local std::uint64_t allocations = 0;
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    if (void* ptr = std::malloc(size != 0 ? size : 1))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+using namespace bmctelemetry;
+namespace
+{
+using Clock = std::chrono::steady_clock;
+namespace resource = opentelemetry::sdk::resource;
+namespace scope_sdk = opentelemetry::sdk::instrumentationscope;
+
+struct BenchOptions
+{
+    // Shape of the synthetic ResourceMetrics
+    std::size_t scopes = 2;
+    std::size_t instruments = 10;
+    std::size_t series = 20;
+    std::size_t buckets = 10;
+    // Operations per thread in the multi-threaded runs
+    std::size_t ops = 200000;
+    std::chrono::milliseconds min_time{200};
+    // Only run benchmarks whose name contains this
+    std::string filter;
+};
+
+struct Result
+{
+    double ns = 0;
+    double allocs = 0;
+};
+
+template <typename T>
+inline void keep(T&& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+/**
+ * Time `fn`, doubling the iteration count until a run takes min_time
+ */
+template <typename Fn>
+Result measure(const BenchOptions& options, Fn&& fn)
+{
+    fn();
+    for (std::uint64_t iterations = 1;; iterations *= 2)
+    {
+        const auto allocs = allocations;
+        const auto start = Clock::now();
+        for (std::uint64_t i = 0; i < iterations; ++i)
+        {
+            fn();
+        }
+        const auto elapsed = Clock::now() - start;
+        if (elapsed >= options.min_time || iterations >= (1ULL << 30))
+        {
+            return {std::chrono::duration<double, std::nano>(elapsed).count() /
+                        static_cast<double>(iterations),
+                    static_cast<double>(allocations - allocs) /
+                        static_cast<double>(iterations)};
+        }
+    }
+}
+
+/**
+ * Wall time per operation of `threads` threads each calling fn(thread, ops)
+ */
+template <typename Fn>
+double parallelNs(std::size_t threads, std::size_t ops, Fn&& fn)
+{
+    std::atomic<bool> go{false};
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (std::size_t t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&, t] {
+            while (!go.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+            fn(t, ops);
+        });
+    }
+    const auto start = Clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start)
+               .count() /
+           static_cast<double>(threads * ops);
+}
+
+bool selected(const BenchOptions& options, const std::string& name)
+{
+    return options.filter.empty() ||
+           name.find(options.filter) != std::string::npos;
+}
+
+void header(const char* title, const char* unit)
+{
+    std::printf("\n%-44s %14s %14s\n", title, "ns/op",
+                (std::string("allocs/") + unit).c_str());
+}
+
+void row(const std::string& name, double ns, double allocs)
+{
+    std::printf("%-44s %14.1f %14.2f\n", name.c_str(), ns, allocs);
+}
+
+/**
+ * Run and report one benchmark; `per` operations make up one call of `fn`
+ */
+template <typename Fn>
+void bench(const BenchOptions& options, const std::string& name,
+           std::size_t per, Fn&& fn)
+{
+    if (!selected(options, name))
+    {
+        return;
+    }
+    auto result = measure(options, std::forward<Fn>(fn));
+    row(name, result.ns / static_cast<double>(per),
+        result.allocs / static_cast<double>(per));
+}
+
+/**
+ * ResourceMetrics with `scopes` scopes of `instruments` instruments, in turn
+ * counters, histograms, gauges and up-down counters, each reporting
+ * `series` series
+ */
+class SyntheticMetrics
+{
+  public:
+    explicit SyntheticMetrics(const BenchOptions& options) :
+        resource_(resource::Resource::Create(
+            {{"service.name", "otelbench"}, {"host.name", "bmc"}}))
+    {
+        std::vector<double> boundaries;
+        for (std::size_t b = 0; b < options.buckets; ++b)
+        {
+            boundaries.push_back(static_cast<double>((b + 1) * 50));
+        }
+        static constexpr metric_sdk::InstrumentType kTypes[] = {
+            metric_sdk::InstrumentType::kCounter,
+            metric_sdk::InstrumentType::kHistogram,
+            metric_sdk::InstrumentType::kObservableGauge,
+            metric_sdk::InstrumentType::kUpDownCounter};
+        for (std::size_t s = 0; s < options.scopes; ++s)
+        {
+            scopes_.push_back(scope_sdk::InstrumentationScope::Create(
+                "scope_" + std::to_string(s), "1.2.0"));
+            metric_sdk::ScopeMetrics scopeMetrics;
+            scopeMetrics.scope_ = scopes_.back().get();
+            for (std::size_t i = 0; i < options.instruments; ++i)
+            {
+                const auto type = kTypes[i % std::size(kTypes)];
+                metric_sdk::MetricData metric;
+                metric.instrument_descriptor = {
+                    "bench.instrument_" + std::to_string(s) + "_" +
+                        std::to_string(i),
+                    "Synthetic instrument",
+                    type == metric_sdk::InstrumentType::kHistogram ? "ms"
+                                                                   : "By",
+                    type, metric_sdk::InstrumentValueType::kDouble};
+                metric.aggregation_temporality =
+                    metric_sdk::AggregationTemporality::kCumulative;
+                metric.start_ts = std::chrono::system_clock::now();
+                metric.end_ts = metric.start_ts;
+                for (std::size_t k = 0; k < options.series; ++k)
+                {
+                    metric_sdk::PointDataAttributes point;
+                    point.attributes.SetAttribute(
+                        "http.method", k % 2 == 0 ? "GET" : "POST");
+                    point.attributes.SetAttribute(
+                        "http.route", "/redfish/v1/Systems/" +
+                                          std::to_string(k % 7));
+                    point.attributes.SetAttribute(
+                        "instance", "instance-" + std::to_string(k));
+                    point.point_data =
+                        pointData(type, k, boundaries);
+                    metric.point_data_attr_.push_back(std::move(point));
+                    ++series_;
+                }
+                scopeMetrics.metric_data_.push_back(std::move(metric));
+            }
+            data_.scope_metric_data_.push_back(std::move(scopeMetrics));
+        }
+        data_.resource_ = &resource_;
+    }
+    SyntheticMetrics(const SyntheticMetrics&) = delete;
+    SyntheticMetrics& operator=(const SyntheticMetrics&) = delete;
+
+    const metric_sdk::ResourceMetrics& data() const noexcept
+    {
+        return data_;
+    }
+    std::size_t series() const noexcept
+    {
+        return series_;
+    }
+
+  private:
+    static metric_sdk::PointType
+        pointData(metric_sdk::InstrumentType type, std::size_t k,
+                  const std::vector<double>& boundaries)
+    {
+        const auto value = 1024.0 * static_cast<double>(k + 1);
+        switch (type)
+        {
+            case metric_sdk::InstrumentType::kHistogram:
+            {
+                metric_sdk::HistogramPointData data;
+                data.boundaries_ = boundaries;
+                data.counts_.assign(boundaries.size() + 1, k + 1);
+                data.count_ = (k + 1) * (boundaries.size() + 1);
+                data.sum_ = 12.5 * static_cast<double>(data.count_);
+                data.min_ = 0.5;
+                data.max_ = 999.5;
+                return data;
+            }
+            case metric_sdk::InstrumentType::kObservableGauge:
+            {
+                metric_sdk::LastValuePointData data;
+                data.value_ = value / 3;
+                data.is_lastvalue_valid_ = true;
+                return data;
+            }
+            default:
+            {
+                metric_sdk::SumPointData data;
+                data.is_monotonic_ =
+                    type == metric_sdk::InstrumentType::kCounter;
+                data.value_ = data.is_monotonic_ ? value : -value;
+                return data;
+            }
+        }
+    }
+
+    resource::Resource resource_;
+    std::vector<decltype(scope_sdk::InstrumentationScope::Create(""))> scopes_;
+    metric_sdk::ResourceMetrics data_;
+    std::size_t series_ = 0;
+};
+
+/**
+ * A small payload of the cases a hand written serializer gets wrong: label
+ * values needing escapes, keys that collide or reorder after sanitizing,
+ * every attribute value type, NaN and infinite values, int64 points, series
+ * without attributes, instruments whose names already carry their unit or
+ * map to the same Prometheus name, and resource and scope strings that need
+ * escaping for target_info and the scope labels. It also carries a summary,
+ * which the exporters add to the SDK data.
+ */
+class EdgeCaseMetrics
+{
+  public:
+    EdgeCaseMetrics() :
+        resource_(resource::Resource::Create(
+            {{"service.name", "otel\"bench\""},
+             {"host.name", "bmc\\0"},
+             {"bmc.description", "line one\nline two"},
+             {"bmc.slot", 3}}))
+    {
+        scope_ = scope_sdk::InstrumentationScope::Create("edge\\scope",
+                                                         "1.2.0\"rc1\"");
+        metric_sdk::ScopeMetrics scopeMetrics;
+        scopeMetrics.scope_ = scope_.get();
+
+        const double kNan = std::numeric_limits<double>::quiet_NaN();
+        const double kInf = std::numeric_limits<double>::infinity();
+
+        auto counter = instrument("bmc.requests_total", "",
+                                  metric_sdk::InstrumentType::kCounter);
+        point(counter, sum(0.0, true), {});
+        point(counter, sum(kInf, true),
+              {{"path", "C:\\Windows\\\"x\""}, {"method", "GET"}});
+        point(counter, sum(std::int64_t{9007199254740993}, true),
+              {{"quote", "\""}, {"newline", "a\nb\n"}});
+        point(counter, sum(1.5e-300, true),
+              {{"empty", ""}, {"utf8", "temp \xc2\xb0" "C"}});
+
+        // a-b and a.b collide after sanitizing; a0 sorts after a.b but
+        // before its sanitized a_b and is dropped
+        auto gauge = instrument("bmc.fan.duty", "1",
+                                metric_sdk::InstrumentType::kObservableGauge);
+        point(gauge, lastValue(kNan), {{"a.b", "x"}, {"a-b", "y"}});
+        point(gauge, lastValue(-kInf), {{"a.b", "1"}, {"a0", "2"}});
+        point(gauge, lastValue(-0.0), {{"a", "1"}, {"b", "2"}});
+        point(gauge, lastValue(std::int64_t{-42}),
+              {{"flag", true},
+               {"int", std::int64_t{-7}},
+               {"uint", std::uint64_t{18446744073709551615ULL}},
+               {"double", 0.1}});
+
+        auto upDown = instrument("bmc.sessions", "{session}",
+                                 metric_sdk::InstrumentType::kUpDownCounter);
+        point(upDown, sum(-3.0, false), {{"type", "redfish"}});
+        point(upDown, sum(kNan, false), {{"type", "ipmi"}});
+
+        // Both become bmc_power_watts
+        auto power = instrument("bmc.power", "W",
+                                metric_sdk::InstrumentType::kObservableGauge);
+        point(power, lastValue(212.25), {});
+        auto powerWatts =
+            instrument("bmc_power_watts", "",
+                       metric_sdk::InstrumentType::kObservableGauge);
+        point(powerWatts, lastValue(212.5), {});
+
+        auto latency = instrument("bmc.latency_milliseconds", "ms",
+                                  metric_sdk::InstrumentType::kHistogram);
+        metric_sdk::HistogramPointData histogram;
+        histogram.boundaries_ = {-1.0, 0.0, 0.25, 1e21};
+        histogram.counts_ = {1, 0, 2, 3, 0};
+        histogram.count_ = 6;
+        histogram.sum_ = kInf;
+        point(latency, std::move(histogram), {{"le", "user label"}});
+        metric_sdk::HistogramPointData integers;
+        integers.boundaries_ = {10.0};
+        integers.counts_ = {4, 1};
+        integers.count_ = 5;
+        integers.sum_ = std::int64_t{37};
+        point(latency, std::move(integers), {});
+
+        for (auto* metric :
+             {&counter, &gauge, &upDown, &power, &powerWatts, &latency})
+        {
+            scopeMetrics.metric_data_.push_back(std::move(*metric));
+        }
+        data_.scope_metric_data_.push_back(std::move(scopeMetrics));
+        data_.resource_ = &resource_;
+
+        summaries_.push_back({"bmc.summary", "Summary \"help\"", "s",
+                              {{0.5, 0.125}, {0.99, kNan}}, kInf, 3});
+    }
+    EdgeCaseMetrics(const EdgeCaseMetrics&) = delete;
+    EdgeCaseMetrics& operator=(const EdgeCaseMetrics&) = delete;
+
+    const metric_sdk::ResourceMetrics& data() const noexcept
+    {
+        return data_;
+    }
+    const std::vector<QuantileSnapshot>& summaries() const noexcept
+    {
+        return summaries_;
+    }
+
+  private:
+    using Attributes = std::vector<
+        std::pair<std::string, opentelemetry::common::AttributeValue>>;
+
+    static metric_sdk::MetricData instrument(std::string name,
+                                             std::string unit,
+                                             metric_sdk::InstrumentType type)
+    {
+        metric_sdk::MetricData metric;
+        metric.instrument_descriptor = {
+            std::move(name), "Edge case", std::move(unit), type,
+            metric_sdk::InstrumentValueType::kDouble};
+        metric.aggregation_temporality =
+            metric_sdk::AggregationTemporality::kCumulative;
+        metric.start_ts = std::chrono::system_clock::now();
+        metric.end_ts = metric.start_ts;
+        return metric;
+    }
+
+    static void point(metric_sdk::MetricData& metric,
+                      metric_sdk::PointType data, const Attributes& attributes)
+    {
+        auto& point = metric.point_data_attr_.emplace_back();
+        for (const auto& [key, value] : attributes)
+        {
+            point.attributes.SetAttribute(key, value);
+        }
+        point.point_data = std::move(data);
+    }
+
+    static metric_sdk::SumPointData sum(metric_sdk::ValueType value,
+                                        bool monotonic)
+    {
+        metric_sdk::SumPointData data;
+        data.value_ = value;
+        data.is_monotonic_ = monotonic;
+        return data;
+    }
+
+    static metric_sdk::LastValuePointData
+        lastValue(metric_sdk::ValueType value)
+    {
+        metric_sdk::LastValuePointData data;
+        data.value_ = value;
+        data.is_lastvalue_valid_ = true;
+        return data;
+    }
+
+    resource::Resource resource_;
+    decltype(scope_sdk::InstrumentationScope::Create("")) scope_;
+    metric_sdk::ResourceMetrics data_;
+    std::vector<QuantileSnapshot> summaries_;
+};
+
+/**
+ * Whether PrometheusTextWriter produces the bytes
+ * TextSerializer::Serialize(TranslateToPrometheus(...)) does for `data`,
+ * with and without target_info and the scope labels. Each case is written
+ * twice so the cached label sets are checked as well.
+ */
+bool writerMatches(const char* name, const metric_sdk::ResourceMetrics& data,
+                   const std::vector<QuantileSnapshot>& summaries = {})
+{
+    bool matches = true;
+    PrometheusTextWriter writer;
+    for (const bool targetInfo : {false, true})
+    {
+        for (const bool withoutScope : {false, true})
+        {
+            const auto expected = prometheus::TextSerializer{}.Serialize(
+                PrometheusExporterUtils::TranslateToPrometheus(
+                    data, targetInfo, withoutScope, summaries));
+            for (int pass = 0; pass < 2; ++pass)
+            {
+                const std::string written(writer.write(
+                    data, targetInfo, withoutScope, summaries));
+                if (written == expected)
+                {
+                    continue;
+                }
+                const auto diverge =
+                    std::mismatch(written.begin(),
+                                  written.begin() +
+                                      static_cast<std::ptrdiff_t>(std::min(
+                                          written.size(), expected.size())),
+                                  expected.begin())
+                        .first;
+                const auto offset =
+                    static_cast<std::size_t>(diverge - written.begin());
+                const auto line = expected.rfind('\n', offset);
+                const auto from = line == std::string::npos ? 0 : line + 1;
+                std::printf("%s (target_info=%d, without_otel_scope=%d, "
+                            "pass %d): writer differs at byte %zu\n"
+                            "  expected: %.120s\n  written:  %.120s\n",
+                            name, targetInfo, withoutScope, pass + 1, offset,
+                            expected.c_str() + from, written.c_str() + from);
+                matches = false;
+                break;
+            }
+        }
+    }
+    return matches;
+}
+
+/**
+ * Metric reader that only collects on demand
+ */
+class CollectingReader final : public metric_sdk::MetricReader
+{
+  public:
+    metric_sdk::AggregationTemporality GetAggregationTemporality(
+        metric_sdk::InstrumentType) const noexcept override
+    {
+        return metric_sdk::AggregationTemporality::kCumulative;
+    }
+
+  private:
+    bool OnForceFlush(std::chrono::microseconds) noexcept override
+    {
+        return true;
+    }
+    bool OnShutdown(std::chrono::microseconds) noexcept override
+    {
+        return true;
+    }
+};
+
+/**
+ * Meter provider whose data is read back through a CollectingReader
+ */
+struct BenchMeterProvider
+{
+    BenchMeterProvider() :
+        owner(metric_sdk::MeterProviderFactory::Create()),
+        provider(static_cast<metric_sdk::MeterProvider*>(owner.get())),
+        reader(std::make_shared<CollectingReader>())
+    {
+        provider->AddMetricReader(reader);
+    }
+
+    nostd::shared_ptr<metrics_api::Meter> meter()
+    {
+        return provider->GetMeter("otelbench", "1.2.0");
+    }
+
+    /**
+     * Prometheus payload of everything recorded so far
+     */
+    std::string payload(std::size_t& series)
+    {
+        std::string text;
+        series = 0;
+        reader->Collect([&](metric_sdk::ResourceMetrics& data) {
+            series = ExportTelemetry::countSeries(data);
+            PrometheusTextWriter writer;
+            text.assign(writer.write(data, false, false));
+            return true;
+        });
+        return text;
+    }
+
+    decltype(metric_sdk::MeterProviderFactory::Create()) owner;
+    metric_sdk::MeterProvider* provider;
+    std::shared_ptr<CollectingReader> reader;
+};
+
+class NullSpanExporter final : public trace_sdk::SpanExporter
+{
+  public:
+    std::unique_ptr<trace_sdk::Recordable> MakeRecordable() noexcept override
+    {
+        return std::make_unique<trace_sdk::SpanData>();
+    }
+    opentelemetry::sdk::common::ExportResult
+        Export(const nostd::span<std::unique_ptr<trace_sdk::Recordable>>&
+                   spans) noexcept override
+    {
+        exported += spans.size();
+        return opentelemetry::sdk::common::ExportResult::kSuccess;
+    }
+    bool Shutdown(std::chrono::microseconds) noexcept override
+    {
+        return true;
+    }
+
+    std::size_t exported = 0;
+};
+
+std::shared_ptr<trace_api::TracerProvider>
+    sdkTracerProvider(LockFreeBatchSpanProcessor*& processor)
+{
+    auto batch = std::make_unique<LockFreeBatchSpanProcessor>(
+        std::make_unique<NullSpanExporter>());
+    processor = batch.get();
+    std::vector<std::unique_ptr<trace_sdk::SpanProcessor>> processors;
+    processors.push_back(std::move(batch));
+    return trace_sdk::TracerProviderFactory::Create(
+        std::move(processors),
+        opentelemetry::sdk::resource::Resource::Create({}),
+        makeSampler(SamplerOptions{}));
+}
+
+void tracedLeaf()
+{
+    TRACE_FUNCION
+}
+
+void tracedCall()
+{
+    TRACE_FUNCION
+    START_TRACE(nested)
+    tracedLeaf();
+}
+
+/**
+ * What the macros expanded to before the tracer was cached: every span
+ * fetched the global provider and looked the tracer up again
+ */
+nostd::shared_ptr<trace::Tracer> uncachedTracer()
+{
+    auto provider = trace::Provider::GetTracerProvider();
+    return provider->GetTracer(libraryname, OPENTELEMETRY_SDK_VERSION);
+}
+
+void uncachedLeaf()
+{
+    auto func_span = trace::Scope(uncachedTracer()->StartSpan(__FUNCTION__));
+}
+
+void uncachedCall()
+{
+    auto func_span = trace::Scope(uncachedTracer()->StartSpan(__FUNCTION__));
+    auto nested = trace::Scope(uncachedTracer()->StartSpan("nested"));
+    uncachedLeaf();
+}
+
+/**
+ * Translation and serialization of one synthetic payload. Also checks that
+ * PrometheusTextWriter produces the bytes TextSerializer does, for that
+ * payload and for EdgeCaseMetrics.
+ */
+bool exporterBenchmarks(const BenchOptions& options)
+{
+    SyntheticMetrics metrics(options);
+    const auto& data = metrics.data();
+    const auto series = metrics.series();
+    std::printf("\nsynthetic payload: %zu scopes x %zu instruments x %zu "
+                "series, %zu buckets = %zu series\n",
+                options.scopes, options.instruments, options.series,
+                options.buckets, series);
+
+    EdgeCaseMetrics edgeCases;
+    bool identical = writerMatches("synthetic payload", data);
+    identical = writerMatches("edge cases", edgeCases.data(),
+                              edgeCases.summaries()) &&
+                identical;
+
+    PrometheusTextWriter writer;
+    const auto families =
+        PrometheusExporterUtils::TranslateToPrometheus(data, false, false);
+    const auto serialized = prometheus::TextSerializer{}.Serialize(families);
+    std::printf("payload: %zu bytes, writer %s TextSerializer on the "
+                "synthetic and edge case payloads\n",
+                serialized.size(), identical ? "matches" : "DIFFERS FROM");
+
+    header("exporter", "series");
+    bench(options, "TranslateToPrometheus", series, [&] {
+        keep(
+            PrometheusExporterUtils::TranslateToPrometheus(data, false, false));
+    });
+    bench(options, "TextSerializer::Serialize", series, [&] {
+        keep(prometheus::TextSerializer{}.Serialize(families));
+    });
+    bench(options, "Translate+Serialize", series, [&] {
+        keep(prometheus::TextSerializer{}.Serialize(
+            PrometheusExporterUtils::TranslateToPrometheus(data, false,
+                                                           false)));
+    });
+    bench(options, "PrometheusTextWriter::write", series,
+          [&] { keep(writer.write(data, false, false)); });
+    {
+        PrometheusTextWriter changeOnly;
+        changeOnly.setChangeOnly(60);
+        bench(options, "PrometheusTextWriter::write (change only)", series,
+              [&] { keep(changeOnly.write(data, false, false)); });
+    }
+    std::ostringstream out;
+    bench(options, "printInstrumentationInfoMetricData", series, [&] {
+        out.str({});
+        for (const auto& scope : data.scope_metric_data_)
+        {
+            printInstrumentationInfoMetricData(out, scope, data);
+        }
+        keep(out);
+    });
+
+    return identical;
+}
+
+/**
+ * Heap allocations made by one call of `fn`, after a warm-up call
+ */
+template <typename Fn>
+std::uint64_t allocationsOf(Fn&& fn)
+{
+    fn();
+    const auto before = allocations;
+    fn();
+    return allocations - before;
+}
+
+/**
+ * Allocations per series of the translation and of the writer for payloads
+ * of `series` and 4 x `series` series per instrument. Copies of point data
+ * would show as allocations per series growing with the payload; they may
+ * only stay flat or fall as fixed costs are spread over more series.
+ */
+bool allocationScaling(const BenchOptions& options)
+{
+    if (!selected(options, "allocations"))
+    {
+        return true;
+    }
+    std::printf("\n%-44s %14s %14s\n", "allocation scaling", "series",
+                "allocs/series");
+    PrometheusTextWriter writer;
+    // Allocations per series at the previous size, per path
+    double translated = -1;
+    double written = -1;
+    bool flat = true;
+    auto check = [&flat](const char* name, std::size_t series,
+                         std::uint64_t allocs, double& previous) {
+        const auto perSeries =
+            static_cast<double>(allocs) / static_cast<double>(series);
+        std::printf("%-44s %14zu %14.2f\n", name, series, perSeries);
+        // Allow for rounding in the fixed per payload costs
+        if (previous >= 0 && perSeries > previous * 1.05 + 0.05)
+        {
+            std::printf("%s: allocations per series grew with the payload\n",
+                        name);
+            flat = false;
+        }
+        previous = perSeries;
+    };
+    for (const std::size_t scale : {1, 4})
+    {
+        BenchOptions sized = options;
+        sized.series = std::max<std::size_t>(options.series, 1) * scale;
+        SyntheticMetrics metrics(sized);
+        const auto& data = metrics.data();
+        const auto translation = allocationsOf([&] {
+            keep(PrometheusExporterUtils::TranslateToPrometheus(data, false,
+                                                                false));
+        });
+        const auto writing =
+            allocationsOf([&] { keep(writer.write(data, false, false)); });
+        check("allocations/TranslateToPrometheus", metrics.series(),
+              translation, translated);
+        check("allocations/PrometheusTextWriter::write", metrics.series(),
+              writing, written);
+    }
+    return flat;
+}
+
+/**
+ * The sanitizer that SanitizeInto replaced: mark invalid characters with _,
+ * mark repeats with = and erase the marks in a second pass. Kept here to
+ * check the table driven version byte for byte.
+ */
+template <typename Valid>
+std::string legacySanitize(std::string name, const Valid& valid)
+{
+    constexpr const auto replacement = '_';
+    constexpr const auto replacement_dup = '=';
+
+    bool has_dup = false;
+    for (int i = 0; i < (int)name.size(); ++i)
+    {
+        if (valid(i, name[i]) && name[i] != replacement)
+        {
+            continue;
+        }
+        if (i > 0 &&
+            (name[i - 1] == replacement || name[i - 1] == replacement_dup))
+        {
+            has_dup = true;
+            name[i] = replacement_dup;
+        }
+        else
+        {
+            name[i] = replacement;
+        }
+    }
+    if (has_dup)
+    {
+        auto end = std::remove(name.begin(), name.end(), replacement_dup);
+        return std::string{name.begin(), end};
+    }
+    return name;
+}
+
+std::string legacySanitizeLabel(std::string label)
+{
+    return legacySanitize(std::move(label), [](int i, char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+               c == '_' || (c >= '0' && c <= '9' && i > 0);
+    });
+}
+
+std::string legacySanitizeName(std::string name)
+{
+    return legacySanitize(std::move(name), [](int i, char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+               c == ':' || (c >= '0' && c <= '9' && i > 0);
+    });
+}
+
+/**
+ * `count` label keys of 0 to 48 bytes, about a third of them invalid
+ * characters: separators, runs of _, =, leading digits, spaces, control
+ * bytes and UTF-8. Generated from a fixed seed so runs are comparable.
+ */
+std::vector<std::string> labelCorpus(std::size_t count)
+{
+    static constexpr std::string_view valid =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    static constexpr std::string_view invalid = "._-/ :=__\t\"{}@#";
+    static constexpr std::string_view utf8[] = {"\xc3\xa9", "\xe2\x82\xac",
+                                                "\xf0\x9f\x94\xa5", "\x7f"};
+    std::uint64_t state = 0x9e3779b97f4a7c15ULL;
+    auto next = [&state] {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast<std::size_t>(state >> 33);
+    };
+    std::vector<std::string> corpus;
+    corpus.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        std::string label;
+        const auto length = next() % 49;
+        while (label.size() < length)
+        {
+            const auto pick = next() % 12;
+            if (pick < 8)
+            {
+                label += valid[next() % valid.size()];
+            }
+            else if (pick < 11)
+            {
+                label += invalid[next() % invalid.size()];
+            }
+            else
+            {
+                label += utf8[next() % std::size(utf8)];
+            }
+        }
+        corpus.push_back(std::move(label));
+    }
+    return corpus;
+}
+
+/**
+ * Name and label sanitizing over a 10k label corpus, checked against the
+ * previous implementation, and the name cache.
+ */
+bool nameBenchmarks(const BenchOptions& options)
+{
+    const auto corpus = labelCorpus(10000);
+    std::size_t mismatches = 0;
+    for (const auto& label : corpus)
+    {
+        if (SanitizeLabel(label) != legacySanitizeLabel(label) ||
+            PrometheusExporterUtils::SanitizeNames(label) !=
+                legacySanitizeName(label))
+        {
+            if (mismatches++ == 0)
+            {
+                std::printf("sanitizer differs on \"%s\"\n", label.c_str());
+            }
+        }
+    }
+    std::printf("\n%zu labels: sanitizers %s the previous implementation\n",
+                corpus.size(), mismatches == 0 ? "match" : "DIFFER FROM");
+
+    header("names", "label");
+    bench(options, "SanitizeLabel/10k corpus", corpus.size(), [&] {
+        for (const auto& label : corpus)
+        {
+            keep(SanitizeLabel(label));
+        }
+    });
+    bench(options, "SanitizeLabel/10k corpus, previous", corpus.size(), [&] {
+        for (const auto& label : corpus)
+        {
+            keep(legacySanitizeLabel(label));
+        }
+    });
+    bench(options, "SanitizeNames/10k corpus", corpus.size(), [&] {
+        for (const auto& label : corpus)
+        {
+            keep(PrometheusExporterUtils::SanitizeNames(label));
+        }
+    });
+    bench(options, "SanitizeNames/10k corpus, previous", corpus.size(), [&] {
+        for (const auto& label : corpus)
+        {
+            keep(legacySanitizeName(label));
+        }
+    });
+
+    header("names", "call");
+    const std::string name = "bmc.fan.speed";
+    const std::string unit = "By/s";
+    bench(options, "MapToPrometheusName", 1, [&] {
+        keep(PrometheusExporterUtils::MapToPrometheusName(
+            name, unit, prometheus_client::MetricType::Counter));
+    });
+    bench(options, "NameCache::lookup", 1, [&] {
+        keep(PrometheusExporterUtils::GetNameCache().lookup(
+            name, unit, prometheus_client::MetricType::Counter));
+    });
+    return mismatches == 0;
+}
+
+void spanBenchmarks(const BenchOptions& options)
+{
+    header("spans (TRACE_FUNCION + START_TRACE + leaf)", "call");
+    setTracingEnabled(false);
+    bench(options, "span/switched off", 1, tracedCall);
+    setTracingEnabled(true);
+    setTracerProvider(std::shared_ptr<trace_api::TracerProvider>(
+        new trace_api::NoopTracerProvider));
+    bench(options, "span/noop provider, uncached tracer", 1, uncachedCall);
+    bench(options, "span/noop provider", 1, tracedCall);
+
+    LockFreeBatchSpanProcessor* processor = nullptr;
+    setTracerProvider(sdkTracerProvider(processor));
+    bench(options, "span/sdk batch processor, uncached tracer", 1,
+          uncachedCall);
+    bench(options, "span/sdk batch processor", 1, tracedCall);
+
+    header("batch span processor, 3 spans per call", "call");
+    for (std::size_t threads : {1, 4, 16})
+    {
+        const std::string name =
+            "batch/" + std::to_string(threads) + " threads";
+        if (!selected(options, name))
+        {
+            continue;
+        }
+        const auto before = processor->stats();
+        const auto ns = parallelNs(threads, options.ops / threads,
+                                   [](std::size_t, std::size_t ops) {
+            for (std::size_t i = 0; i < ops; ++i)
+            {
+                tracedCall();
+            }
+        });
+        processor->ForceFlush();
+        const auto after = processor->stats();
+        row(name, ns, 0);
+        std::printf("%-44s %14llu dropped of %llu\n", "",
+                    static_cast<unsigned long long>(after.dropped -
+                                                    before.dropped),
+                    static_cast<unsigned long long>(
+                        after.enqueued - before.enqueued + after.dropped -
+                        before.dropped));
+    }
+    setTracerProvider(nullptr);
+}
+
+void counterScaling(const BenchOptions& options)
+{
+    BenchMeterProvider provider;
+    auto meter = provider.meter();
+    auto counter = meter->CreateDoubleCounter("bench_counter");
+    ShardedCounter sharded(
+        meter->CreateDoubleObservableCounter("bench_sharded_counter"));
+
+    header("counter Add scaling (wall ns per Add)", "op");
+    for (std::size_t threads = 1; threads <= 64; threads *= 2)
+    {
+        const auto suffix = "/" + std::to_string(threads) + " threads";
+        const auto ops = std::max<std::size_t>(options.ops / threads, 1000);
+        if (selected(options, "counter/sdk Add" + suffix))
+        {
+            const auto ns = parallelNs(threads, ops,
+                                       [&](std::size_t, std::size_t n) {
+                for (std::size_t i = 0; i < n; ++i)
+                {
+                    counter->Add(1.0);
+                }
+            });
+            row("counter/sdk Add" + suffix, ns, 0);
+        }
+        if (selected(options, "counter/sharded Add" + suffix))
+        {
+            const auto ns = parallelNs(threads, ops,
+                                       [&](std::size_t, std::size_t n) {
+                for (std::size_t i = 0; i < n; ++i)
+                {
+                    sharded.Add(1.0);
+                }
+            });
+            row("counter/sharded Add" + suffix, ns, 0);
+        }
+    }
+}
+
+void boundBenchmarks(const BenchOptions& options)
+{
+    BenchMeterProvider provider;
+    auto meter = provider.meter();
+    auto counter = meter->CreateDoubleCounter("bench_attr_counter");
+    auto histogram =
+        meter->CreateDoubleHistogram("bench_histogram", "latency", "ms");
+    AttributeInterner interner;
+    auto set = interner.intern({{"key1", "value1"}, {"key2", "value2"}});
+    BoundCounterFamily family(
+        meter->CreateDoubleObservableCounter("bench_bound_counter"));
+    auto boundCounter = family.bind(set);
+    BoundHistogram boundHistogram(histogram.get(), set);
+    const std::map<std::string, std::string> labels{{"key1", "value1"},
+                                                    {"key2", "value2"}};
+    const auto context = opentelemetry::context::Context{};
+
+    header("bound instruments, 2 attributes", "op");
+    bench(options, "histogram/Record, map per call", 1, [&] {
+        // What histogram_example does
+        std::map<std::string, std::string> perCall{{"key1", "value1"},
+                                                   {"key2", "value2"}};
+        histogram->Record(
+            42.0,
+            common::KeyValueIterableView<decltype(perCall)>{perCall},
+            context);
+    });
+    bench(options, "histogram/Record, prebuilt map", 1, [&] {
+        histogram->Record(
+            42.0, common::KeyValueIterableView<decltype(labels)>{labels},
+            context);
+    });
+    bench(options, "histogram/BoundHistogram::Record", 1,
+          [&] { boundHistogram.Record(42.0); });
+    bench(options, "counter/Add, prebuilt map", 1, [&] {
+        counter->Add(1.0,
+                     common::KeyValueIterableView<decltype(labels)>{labels});
+    });
+    bench(options, "counter/BoundCounter::Add", 1,
+          [&] { boundCounter.Add(1.0); });
+}
+
+/**
+ * Aggregation state and payload of a histogram recorded with five
+ * attribute keys, with and without an allow-list keeping two of them. Heap
+ * use comes from glibc's mallinfo2.
+ */
+void filterBenchmarks(const BenchOptions& options)
+{
+    if (!selected(options, "filter"))
+    {
+        return;
+    }
+    std::printf("\n%-44s %10s %14s %14s\n", "attribute filter, 5 keys",
+                "series", "heap KiB", "payload bytes");
+    for (bool filtered : {false, true})
+    {
+        const auto heapBefore = mallinfo2().uordblks;
+        std::size_t series = 0;
+        std::size_t bytes = 0;
+        {
+            BenchMeterProvider provider;
+            if (filtered)
+            {
+                provider.provider->AddView(
+                    metric_sdk::InstrumentSelectorFactory::Create(
+                        metric_sdk::InstrumentType::kHistogram,
+                        "bench_filtered", "ms"),
+                    metric_sdk::MeterSelectorFactory::Create("otelbench",
+                                                             "1.2.0", ""),
+                    metric_sdk::ViewFactory::Create(
+                        "bench_filtered", "", "ms",
+                        metric_sdk::AggregationType::kHistogram, nullptr,
+                        std::make_unique<FilteringAttributesProcessor>(
+                            AttributeFilter::allow({"method", "status"}))));
+            }
+            auto histogram = provider.meter()->CreateDoubleHistogram(
+                "bench_filtered", "", "ms");
+            const auto context = opentelemetry::context::Context{};
+            for (std::size_t i = 0; i < options.ops / 10; ++i)
+            {
+                const std::map<std::string, std::string> labels{
+                    {"method", i % 2 == 0 ? "GET" : "PATCH"},
+                    {"status", std::to_string(200 + i % 3)},
+                    {"route", "/redfish/v1/Chassis/" + std::to_string(i % 16)},
+                    {"client", "10.0.0." + std::to_string(i % 32)},
+                    {"session", std::to_string(i % 64)}};
+                histogram->Record(
+                    static_cast<double>(i % 1000),
+                    common::KeyValueIterableView<decltype(labels)>{labels},
+                    context);
+            }
+            const auto heap = mallinfo2().uordblks - heapBefore;
+            bytes = provider.payload(series).size();
+            std::printf("%-44s %10zu %14.1f %14zu\n",
+                        filtered ? "filter/allow 2 keys" : "filter/all keys",
+                        series, static_cast<double>(heap) / 1024, bytes);
+        }
+    }
+}
+
+std::size_t parseSize(const char* value)
+{
+    return static_cast<std::size_t>(std::strtoull(value, nullptr, 10));
+}
+
+void usage(const char* program)
+{
+    std::fprintf(stderr,
+                 "usage: %s [--scopes N] [--instruments N] [--series N] "
+                 "[--buckets N] [--ops N] [--min-time MS] [--filter TEXT]\n",
+                 program);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            usage(argv[0]);
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (std::strcmp(arg, "--scopes") == 0)
+        {
+            options.scopes = parseSize(value);
+        }
+        else if (std::strcmp(arg, "--instruments") == 0)
+        {
+            options.instruments = parseSize(value);
+        }
+        else if (std::strcmp(arg, "--series") == 0)
+        {
+            options.series = parseSize(value);
+        }
+        else if (std::strcmp(arg, "--buckets") == 0)
+        {
+            options.buckets = parseSize(value);
+        }
+        else if (std::strcmp(arg, "--ops") == 0)
+        {
+            options.ops = std::max<std::size_t>(parseSize(value), 64);
+        }
+        else if (std::strcmp(arg, "--min-time") == 0)
+        {
+            options.min_time = std::chrono::milliseconds(parseSize(value));
+        }
+        else if (std::strcmp(arg, "--filter") == 0)
+        {
+            options.filter = value;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    bool passed = exporterBenchmarks(options);
+    passed = allocationScaling(options) && passed;
+    passed = nameBenchmarks(options) && passed;
+    spanBenchmarks(options);
+    counterScaling(options);
+    boundBenchmarks(options);
+    filterBenchmarks(options);
+    return passed ? 0 : 1;
+}
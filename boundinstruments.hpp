@@ -0,0 +1,249 @@
+#pragma once
+
+#include "opentelemetry/common/key_value_iterable_view.h"
+#include "opentelemetry/context/context.h"
+#include "opentelemetry/metrics/async_instruments.h"
+#include "opentelemetry/metrics/meter_provider.h"
+#include "opentelemetry/metrics/observer_result.h"
+#include "opentelemetry/metrics/sync_instruments.h"
+#include "opentelemetry/nostd/shared_ptr.h"
+#include "opentelemetry/nostd/variant.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace bmctelemetry
+{
+
+/**
+ * An immutable set of string attributes, built once and then handed to the
+ * SDK as a ready made KeyValueIterable
+ */
+class AttributeSet
+{
+  public:
+    using Items = std::vector<std::pair<opentelemetry::nostd::string_view,
+                                        opentelemetry::common::AttributeValue>>;
+
+    explicit AttributeSet(std::vector<std::pair<std::string, std::string>>
+                              attributes) :
+        storage_(std::move(attributes)), view_(items_)
+    {
+        items_.reserve(storage_.size());
+        for (const auto& [key, value] : storage_)
+        {
+            items_.emplace_back(
+                opentelemetry::nostd::string_view(key.data(), key.size()),
+                opentelemetry::nostd::string_view(value.data(), value.size()));
+        }
+    }
+    AttributeSet(const AttributeSet&) = delete;
+    AttributeSet& operator=(const AttributeSet&) = delete;
+
+    const opentelemetry::common::KeyValueIterable& view() const noexcept
+    {
+        return view_;
+    }
+
+  private:
+    std::vector<std::pair<std::string, std::string>> storage_;
+    Items items_;
+    opentelemetry::common::KeyValueIterableView<Items> view_;
+};
+
+/**
+ * Hands out one shared AttributeSet per distinct set of attributes. Key
+ * order does not matter.
+ */
+class AttributeInterner
+{
+  public:
+    std::shared_ptr<const AttributeSet> intern(
+        std::initializer_list<std::pair<std::string_view, std::string_view>>
+            attributes)
+    {
+        std::vector<std::pair<std::string, std::string>> sorted;
+        sorted.reserve(attributes.size());
+        for (const auto& [key, value] : attributes)
+        {
+            sorted.emplace_back(key, value);
+        }
+        std::sort(sorted.begin(), sorted.end());
+
+        std::string key;
+        for (const auto& [name, value] : sorted)
+        {
+            key.append(name).push_back('\0');
+            key.append(value).push_back('\0');
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& set = sets_[key];
+        if (!set)
+        {
+            set = std::make_shared<const AttributeSet>(std::move(sorted));
+        }
+        return set;
+    }
+
+  private:
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<const AttributeSet>> sets_;
+};
+
+/**
+ * Counter handle bound to one attribute set. Add is a single relaxed atomic
+ * update of the cell; the cell is read when the metric reader collects. The
+ * handle shares ownership of its family, so it stays valid after the
+ * OtelMetrics that bound it is gone; Adds are then no longer collected.
+ */
+class BoundCounter
+{
+  public:
+    void Add(double value) noexcept
+    {
+        cell_->value.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    /**
+     * Handle whose Adds go nowhere, for names that cannot be bound
+     */
+    static BoundCounter discarding()
+    {
+        static Cell cell(nullptr);
+        return BoundCounter(std::shared_ptr<Cell>(std::shared_ptr<Cell>(),
+                                                  &cell));
+    }
+
+  private:
+    friend class BoundCounterFamily;
+
+    struct alignas(64) Cell
+    {
+        explicit Cell(std::shared_ptr<const AttributeSet> set) :
+            attributes(std::move(set))
+        {}
+        std::atomic<double> value{0};
+        std::shared_ptr<const AttributeSet> attributes;
+    };
+
+    explicit BoundCounter(std::shared_ptr<Cell> cell) : cell_(std::move(cell))
+    {}
+
+    // Aliases the owning family
+    std::shared_ptr<Cell> cell_;
+};
+
+/**
+ * Monotonic counter whose attribute sets are bound up front. Each bound set
+ * owns a cell; collection reports every cell through the callback of an
+ * observable counter, so recording never hashes or copies attributes.
+ */
+class BoundCounterFamily :
+    public std::enable_shared_from_this<BoundCounterFamily>
+{
+  public:
+    explicit BoundCounterFamily(
+        opentelemetry::nostd::shared_ptr<
+            opentelemetry::metrics::ObservableInstrument>
+            instrument) : instrument_(std::move(instrument))
+    {
+        instrument_->AddCallback(observe, this);
+    }
+    BoundCounterFamily(const BoundCounterFamily&) = delete;
+    BoundCounterFamily& operator=(const BoundCounterFamily&) = delete;
+    ~BoundCounterFamily()
+    {
+        instrument_->RemoveCallback(observe, this);
+    }
+
+    /**
+     * Handle for `attributes`; binding the same set again returns a handle
+     * to the same cell. Handles stay valid as long as the family.
+     */
+    BoundCounter bind(const std::shared_ptr<const AttributeSet>& attributes)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& cell : cells_)
+        {
+            if (cell.attributes == attributes)
+            {
+                return BoundCounter(
+                    std::shared_ptr<BoundCounter::Cell>(shared_from_this(),
+                                                        &cell));
+            }
+        }
+        return BoundCounter(std::shared_ptr<BoundCounter::Cell>(
+            shared_from_this(), &cells_.emplace_back(attributes)));
+    }
+
+  private:
+    static void observe(opentelemetry::metrics::ObserverResult result,
+                        void* state)
+    {
+        using DoubleResult = opentelemetry::nostd::shared_ptr<
+            opentelemetry::metrics::ObserverResultT<double>>;
+        if (!opentelemetry::nostd::holds_alternative<DoubleResult>(result))
+        {
+            return;
+        }
+        auto& observer = opentelemetry::nostd::get<DoubleResult>(result);
+        auto* family = static_cast<BoundCounterFamily*>(state);
+        std::lock_guard<std::mutex> lock(family->mutex_);
+        for (const auto& cell : family->cells_)
+        {
+            observer->Observe(cell.value.load(std::memory_order_relaxed),
+                              cell.attributes->view());
+        }
+    }
+
+    opentelemetry::nostd::shared_ptr<
+        opentelemetry::metrics::ObservableInstrument>
+        instrument_;
+    std::mutex mutex_;
+    // deque keeps cell addresses stable as cells are added
+    std::deque<BoundCounter::Cell> cells_;
+};
+
+/**
+ * Histogram handle bound to one attribute set. Record passes the prebuilt
+ * attributes straight to the SDK instead of building them per call.
+ *
+ * The SDK histogram refers to the views of the provider that created it, so
+ * the handle shares ownership of both. It stays valid after the OtelMetrics
+ * that bound it is gone; Records are then no longer collected.
+ */
+class BoundHistogram
+{
+  public:
+    BoundHistogram(
+        std::shared_ptr<opentelemetry::metrics::MeterProvider> provider,
+        std::shared_ptr<opentelemetry::metrics::Histogram<double>> histogram,
+        std::shared_ptr<const AttributeSet> attributes) :
+        provider_(std::move(provider)), histogram_(std::move(histogram)),
+        attributes_(std::move(attributes))
+    {}
+
+    void Record(double value) noexcept
+    {
+        histogram_->Record(value, attributes_->view(), context_);
+    }
+
+  private:
+    // Declared first so the histogram goes before its provider
+    std::shared_ptr<opentelemetry::metrics::MeterProvider> provider_;
+    std::shared_ptr<opentelemetry::metrics::Histogram<double>> histogram_;
+    std::shared_ptr<const AttributeSet> attributes_;
+    opentelemetry::context::Context context_;
+};
+
+} // namespace bmctelemetry
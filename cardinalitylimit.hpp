@@ -0,0 +1,59 @@
+#pragma once
+
+#include "opentelemetry/sdk/common/global_log_handler.h"
+#include "opentelemetry/sdk/metrics/aggregation/aggregation_config.h"
+
+#include <cstddef>
+#include <memory>
+
+namespace bmctelemetry
+{
+
+/**
+ * Attribute of the series that absorbs the attribute sets beyond a view's
+ * cardinality limit
+ */
+inline constexpr const char* kOverflowAttribute = "otel.metric.overflow";
+
+/**
+ * Cap the distinct attribute sets of a view at `limit`; measurements with
+ * any further set are aggregated into one otel.metric.overflow=true series.
+ *
+ * The limit is the SDK's own AggregationConfig::cardinality_limit_, which
+ * the attributes hashmap enforces for sync and async storage alike, however
+ * the SDK hashes the measurement attributes. An AttributesProcessor cannot
+ * do this: newer SDKs only ask it about single keys through isPresent().
+ * Supported SDKs are the opentelemetry-cpp releases whose AggregationConfig
+ * has cardinality_limit_; with older ones the limit is ignored with a
+ * warning and the SDK's fixed default applies.
+ *
+ * @return `config`, or a default config when it is null
+ */
+template <typename Config = opentelemetry::sdk::metrics::AggregationConfig>
+std::shared_ptr<Config> limitCardinality(std::shared_ptr<Config> config,
+                                         std::size_t limit)
+{
+    if (limit == 0)
+    {
+        return config;
+    }
+    if (!config)
+    {
+        config = std::make_shared<Config>();
+    }
+    if constexpr (requires { config->cardinality_limit_; })
+    {
+        // The SDK counts the overflow series against the limit
+        config->cardinality_limit_ = limit + 1;
+    }
+    else
+    {
+        OTEL_INTERNAL_LOG_WARN(
+            "[Cardinality Limit] this SDK has no per view cardinality limit, "
+            "ignoring a limit of "
+            << limit);
+    }
+    return config;
+}
+
+} // namespace bmctelemetry
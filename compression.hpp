@@ -0,0 +1,85 @@
+#pragma once
+
+#include "opentelemetry/sdk/common/global_log_handler.h"
+
+#include <zlib.h>
+
+#include <string>
+#include <string_view>
+
+namespace bmctelemetry
+{
+
+/**
+ * gzip compressor that keeps its zlib stream between calls, so compressing a
+ * payload only resets the deflate state instead of reallocating it.
+ */
+class GzipCompressor
+{
+  public:
+    explicit GzipCompressor(int level = Z_DEFAULT_COMPRESSION) : level_(level)
+    {}
+    GzipCompressor(const GzipCompressor&) = delete;
+    GzipCompressor& operator=(const GzipCompressor&) = delete;
+    ~GzipCompressor()
+    {
+        if (initialized_)
+        {
+            deflateEnd(&stream_);
+        }
+    }
+
+    /**
+     * Compress `in` into `out`, replacing its content.
+     *
+     * @return false if zlib reported an error; `out` is then unspecified
+     */
+    bool compress(std::string_view in, std::string& out)
+    {
+        if (!init())
+        {
+            return false;
+        }
+        out.resize(deflateBound(&stream_, static_cast<uLong>(in.size())));
+        stream_.next_in =
+            reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+        stream_.avail_in = static_cast<uInt>(in.size());
+        stream_.next_out = reinterpret_cast<Bytef*>(out.data());
+        stream_.avail_out = static_cast<uInt>(out.size());
+
+        int ret = deflate(&stream_, Z_FINISH);
+        out.resize(stream_.total_out);
+        deflateReset(&stream_);
+        if (ret != Z_STREAM_END)
+        {
+            OTEL_INTERNAL_LOG_ERROR("[Gzip] deflate failed: " << ret);
+            return false;
+        }
+        return true;
+    }
+
+  private:
+    bool init()
+    {
+        if (initialized_)
+        {
+            return true;
+        }
+        // windowBits 15 + 16 selects the gzip wrapper
+        int ret = deflateInit2(&stream_, level_, Z_DEFLATED, 15 + 16, 8,
+                               Z_DEFAULT_STRATEGY);
+        if (ret != Z_OK)
+        {
+            OTEL_INTERNAL_LOG_ERROR("[Gzip] deflateInit2 failed: " << ret);
+            return false;
+        }
+        initialized_ = true;
+        return true;
+    }
+
+    int level_;
+    bool initialized_ = false;
+    z_stream stream_{};
+};
+
+} // namespace bmctelemetry
@@ -1,6 +1,8 @@
 // Copyright The OpenTelemetry Authors
 // SPDX-License-Identifier: Apache-2.0
 
+#pragma once
+
 #include "opentelemetry/common/macros.h"
 #include "opentelemetry/sdk/common/global_log_handler.h"
 #include "opentelemetry/sdk/metrics/export/metric_producer.h"
@@ -9,10 +11,19 @@
 #include "opentelemetry/trace/semantic_conventions.h"
 #include "prometheus/metric_family.h"
 #include "prometheus/metric_type.h"
+#include "quantilesketch.hpp"
 
 #include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <atomic>
 #include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <regex>
+#include <string_view>
 #include <sstream>
 #include <string>
 #include <unordered_map>
@@ -33,48 +44,73 @@ static constexpr const char* kScopeNameKey = "otel_scope_name";
 static constexpr const char* kScopeVersionKey = "otel_scope_version";
 
 /**
- * Sanitize the given metric name by replacing invalid characters with _,
- * ensuring that multiple consecutive _ characters are collapsed to a single
- * _.
- *
- * @param valid a callable with the signature `(int pos, char ch) -> bool`
- * that returns whether `ch` is valid at position `pos` in the string
- * @param name the string to sanitize
+ * Character classes used by the single pass sanitizers below. Each byte of
+ * the input is classified with one table lookup; the sanitizers then only
+ * test the class bits that are valid for the current position.
  */
-template <typename T>
-inline std::string Sanitize(std::string name, const T& valid)
+enum CharClass : std::uint8_t
 {
-    static_assert(std::is_convertible<T, std::function<bool(int, char)>>::value,
-                  "valid should be a callable with the signature "
-                  "(int, char) -> bool");
+    kAlpha = 1 << 0,
+    kDigit = 1 << 1,
+    kColon = 1 << 2,
+};
 
+inline constexpr std::array<std::uint8_t, 256> kCharClassTable = [] {
+    std::array<std::uint8_t, 256> table{};
+    for (int c = 'a'; c <= 'z'; ++c)
+    {
+        table[c] |= kAlpha;
+    }
+    for (int c = 'A'; c <= 'Z'; ++c)
+    {
+        table[c] |= kAlpha;
+    }
+    for (int c = '0'; c <= '9'; ++c)
+    {
+        table[c] |= kDigit;
+    }
+    table[':'] |= kColon;
+    return table;
+}();
+
+inline std::uint8_t charClass(char c) noexcept
+{
+    return kCharClassTable[static_cast<unsigned char>(c)];
+}
+
+/**
+ * Copy `in` to `out` replacing every character that is not valid at its
+ * position with _, collapsing runs of replaced characters (and of _ itself)
+ * to a single _.
+ *
+ * @param first_valid class bits accepted at position 0
+ * @param valid class bits accepted at every other position
+ * @param out buffer of at least in.size() bytes
+ * @return number of bytes written to out
+ */
+inline std::size_t SanitizeInto(std::string_view in, char* out,
+                                std::uint8_t first_valid,
+                                std::uint8_t valid) noexcept
+{
     constexpr const auto replacement = '_';
-    constexpr const auto replacement_dup = '=';
 
-    bool has_dup = false;
-    for (int i = 0; i < (int)name.size(); ++i)
+    std::size_t written = 0;
+    bool replaced = false;
+    for (std::size_t i = 0; i < in.size(); ++i)
     {
-        if (valid(i, name[i]) && name[i] != replacement)
+        const char c = in[i];
+        if (charClass(c) & (i == 0 ? first_valid : valid))
         {
-            continue;
+            out[written++] = c;
+            replaced = false;
         }
-        if (i > 0 &&
-            (name[i - 1] == replacement || name[i - 1] == replacement_dup))
+        else if (!replaced)
         {
-            has_dup = true;
-            name[i] = replacement_dup;
+            out[written++] = replacement;
+            replaced = true;
         }
-        else
-        {
-            name[i] = replacement;
-        }
-    }
-    if (has_dup)
-    {
-        auto end = std::remove(name.begin(), name.end(), replacement_dup);
-        return std::string{name.begin(), end};
     }
-    return name;
+    return written;
 }
 
 /**
@@ -82,20 +118,205 @@ inline std::string Sanitize(std::string name, const T& valid)
  * Prometheus metric label keys are required to match the following regex:
  *   [a-zA-Z_]([a-zA-Z0-9_])*
  * and multiple consecutive _ characters must be collapsed to a single _.
+ *
+ * @param out buffer of at least label_key.size() bytes
+ * @return number of bytes written to out
+ */
+inline std::size_t SanitizeLabelInto(std::string_view label_key,
+                                     char* out) noexcept
+{
+    return SanitizeInto(label_key, out, kAlpha, kAlpha | kDigit);
+}
+
+/**
+ * Sanitize the given metric name: alphanumeric characters and ':' are kept,
+ * a leading digit and every other character become _, and consecutive _
+ * are collapsed.
+ *
+ * @param out buffer of at least name.size() bytes
+ * @return number of bytes written to out
+ */
+inline std::size_t SanitizeNameInto(std::string_view name, char* out) noexcept
+{
+    return SanitizeInto(name, out, kAlpha | kColon, kAlpha | kDigit | kColon);
+}
+
+/**
+ * Replace every non alphanumeric character with _, collapse consecutive _
+ * and strip leading and trailing _. Matches the regex based clean up that
+ * was used for metric names and units.
+ *
+ * @param out buffer of at least str.size() bytes
+ * @return number of bytes written to out
  */
+inline std::size_t CleanUpInto(std::string_view str, char* out) noexcept
+{
+    std::size_t written = 0;
+    bool pending_underscore = false;
+    for (const char c : str)
+    {
+        if (charClass(c) & (kAlpha | kDigit))
+        {
+            if (pending_underscore)
+            {
+                out[written++] = '_';
+                pending_underscore = false;
+            }
+            out[written++] = c;
+        }
+        else
+        {
+            pending_underscore = written > 0;
+        }
+    }
+    return written;
+}
+
+/**
+ * Append the result of a *Into sanitizer to `out` without creating a
+ * temporary string.
+ */
+template <typename Fn>
+inline void AppendSanitized(std::string& out, std::string_view in, Fn&& fn)
+{
+    const auto offset = out.size();
+    out.resize(offset + in.size());
+    out.resize(offset + fn(in, out.data() + offset));
+}
+
 inline std::string SanitizeLabel(std::string label_key)
 {
-    return Sanitize(label_key, [](int i, char c) {
-        return (c >= 'a' && c <= 'z') || //
-               (c >= 'A' && c <= 'Z') || //
-               c == '_' ||               //
-               (c >= '0' && c <= '9' && i > 0);
-    });
+    label_key.resize(SanitizeLabelInto(label_key, label_key.data()));
+    return label_key;
 }
 
 } // namespace
 struct PrometheusExporterUtils
 {
+    /**
+     * Cache of translated Prometheus metric names.
+     *
+     * Instrument names and units do not change once registered, so the
+     * result of MapToPrometheusName (and the regex work behind it) is
+     * memoized per (instrument name, unit, Prometheus type). The cache stops
+     * admitting new entries once max_entries is reached; lookups past that
+     * point fall back to translating on every call.
+     */
+    class NameCache
+    {
+      public:
+        static constexpr std::size_t kDefaultMaxEntries = 4096;
+
+        explicit NameCache(std::size_t max_entries = kDefaultMaxEntries) :
+            max_entries_(max_entries)
+        {}
+
+        std::string lookup(const std::string& name, const std::string& unit,
+                           prometheus_client::MetricType type)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                auto it = entries_.find(KeyView{name, unit, type});
+                if (it != entries_.end())
+                {
+                    hits_.fetch_add(1, std::memory_order_relaxed);
+                    return it->second;
+                }
+            }
+            misses_.fetch_add(1, std::memory_order_relaxed);
+            auto translated = MapToPrometheusName(name, unit, type);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (entries_.size() < max_entries_)
+            {
+                entries_.emplace(Key{name, unit, type}, translated);
+            }
+            return translated;
+        }
+        std::uint64_t hits() const noexcept
+        {
+            return hits_.load(std::memory_order_relaxed);
+        }
+        std::uint64_t misses() const noexcept
+        {
+            return misses_.load(std::memory_order_relaxed);
+        }
+        std::size_t size() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return entries_.size();
+        }
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            entries_.clear();
+        }
+
+      private:
+        struct Key
+        {
+            std::string name;
+            std::string unit;
+            prometheus_client::MetricType type;
+        };
+        struct KeyView
+        {
+            std::string_view name;
+            std::string_view unit;
+            prometheus_client::MetricType type;
+        };
+        struct KeyHash
+        {
+            using is_transparent = void;
+            std::size_t operator()(const KeyView& k) const noexcept
+            {
+                std::size_t seed = std::hash<std::string_view>{}(k.name);
+                seed ^= std::hash<std::string_view>{}(k.unit) + 0x9e3779b9 +
+                        (seed << 6) + (seed >> 2);
+                return seed ^ (static_cast<std::size_t>(k.type) << 1);
+            }
+            std::size_t operator()(const Key& k) const noexcept
+            {
+                return (*this)(KeyView{k.name, k.unit, k.type});
+            }
+        };
+        struct KeyEqual
+        {
+            using is_transparent = void;
+            static KeyView view(const Key& k) noexcept
+            {
+                return KeyView{k.name, k.unit, k.type};
+            }
+            static KeyView view(const KeyView& k) noexcept
+            {
+                return k;
+            }
+            template <typename L, typename R>
+            bool operator()(const L& l, const R& r) const noexcept
+            {
+                auto lv = view(l);
+                auto rv = view(r);
+                return lv.type == rv.type && lv.name == rv.name &&
+                       lv.unit == rv.unit;
+            }
+        };
+
+        std::size_t max_entries_;
+        mutable std::mutex mutex_;
+        std::unordered_map<Key, std::string, KeyHash, KeyEqual> entries_;
+        std::atomic<std::uint64_t> hits_{0};
+        std::atomic<std::uint64_t> misses_{0};
+    };
+
+    /**
+     * Process wide name cache used by TranslateToPrometheus
+     */
+    static NameCache& GetNameCache()
+    {
+        static NameCache cache;
+        return cache;
+    }
+
     /**
      * Helper function to convert OpenTelemetry metrics data collection
      * to Prometheus metrics data collection
@@ -107,10 +328,12 @@ struct PrometheusExporterUtils
     static std::vector<prometheus_client::MetricFamily>
         TranslateToPrometheus(const sdk::metrics::ResourceMetrics& data,
                               bool populate_target_info,
-                              bool without_otel_scope)
+                              bool without_otel_scope,
+                              const std::vector<QuantileSnapshot>& summaries =
+                                  {})
     {
         // initialize output vector
-        std::size_t reserve_size = 1;
+        std::size_t reserve_size = 1 + summaries.size();
         for (const auto& instrumentation_info : data.scope_metric_data_)
         {
             reserve_size += instrumentation_info.metric_data_.size();
@@ -118,10 +341,6 @@ struct PrometheusExporterUtils
 
         std::vector<prometheus_client::MetricFamily> output;
         output.reserve(reserve_size);
-        if (data.scope_metric_data_.empty())
-        {
-            return output;
-        }
         // Append target_info as the first metric
         if (populate_target_info && !data.scope_metric_data_.empty())
         {
@@ -139,120 +358,143 @@ struct PrometheusExporterUtils
         {
             for (const auto& metric_data : instrumentation_info.metric_data_)
             {
-                auto origin_name = metric_data.instrument_descriptor.name_;
-                auto unit = metric_data.instrument_descriptor.unit_;
-                prometheus_client::MetricFamily metric_family;
-                metric_family.help =
-                    metric_data.instrument_descriptor.description_;
-                auto time = metric_data.end_ts.time_since_epoch();
-                auto front = metric_data.point_data_attr_.front();
-                auto kind = getAggregationType(front.point_data);
-                bool is_monotonic = true;
-                if (kind == sdk::metrics::AggregationType::kSum)
+                SetFamily(metric_data,
+                          without_otel_scope ? nullptr
+                                             : instrumentation_info.scope_,
+                          data.resource_, &output);
+            }
+        }
+        SetSummaries(summaries, &output);
+        return output;
+    }
+
+    /**
+     * Translate one instrument into a MetricFamily appended to `output`
+     */
+    static void SetFamily(
+        const sdk::metrics::MetricData& metric_data,
+        const opentelemetry::sdk::instrumentationscope::InstrumentationScope*
+            scope,
+        const opentelemetry::sdk::resource::Resource* resource,
+        std::vector<prometheus_client::MetricFamily>* output)
+    {
+        if (metric_data.point_data_attr_.empty())
+        {
+            return;
+        }
+        prometheus_client::MetricFamily metric_family;
+        metric_family.help = metric_data.instrument_descriptor.description_;
+        auto time = metric_data.end_ts.time_since_epoch();
+        const auto& front = metric_data.point_data_attr_.front();
+        auto kind = getAggregationType(front.point_data);
+        bool is_monotonic = true;
+        if (kind == sdk::metrics::AggregationType::kSum)
+        {
+            is_monotonic =
+                nostd::get<sdk::metrics::SumPointData>(front.point_data)
+                    .is_monotonic_;
+        }
+        const prometheus_client::MetricType type =
+            TranslateType(kind, is_monotonic);
+        metric_family.name = GetNameCache().lookup(
+            metric_data.instrument_descriptor.name_,
+            metric_data.instrument_descriptor.unit_, type);
+        metric_family.type = type;
+        metric_family.metric.reserve(metric_data.point_data_attr_.size());
+        const bool exponential =
+            kind == sdk::metrics::AggregationType::kBase2ExponentialHistogram;
+        const std::int32_t export_scale =
+            exponential ? ExponentialExportScale(
+                              metric_data.instrument_descriptor.name_)
+                        : kExponentialBucketScale;
+
+        for (const auto& point_data_attr : metric_data.point_data_attr_)
+        {
+            if (exponential)
+            {
+                metric_family.metric.emplace_back();
+                auto& metric = metric_family.metric.back();
+                SetMetricBasic(metric, point_data_attr.attributes, time, scope,
+                               resource);
+                SetValue(
+                    nostd::get<sdk::metrics::Base2ExponentialHistogramPointData>(
+                        point_data_attr.point_data),
+                    export_scale, &metric);
+            }
+            else if (type == prometheus_client::MetricType::Histogram)
+            {
+                const auto& histogram_point_data =
+                    nostd::get<sdk::metrics::HistogramPointData>(
+                        point_data_attr.point_data);
+                double sum = 0.0;
+                if (nostd::holds_alternative<double>(histogram_point_data.sum_))
+                {
+                    sum = nostd::get<double>(histogram_point_data.sum_);
+                }
+                else
+                {
+                    sum = static_cast<double>(
+                        nostd::get<int64_t>(histogram_point_data.sum_));
+                }
+                SetData(sum, histogram_point_data.count_,
+                        histogram_point_data.boundaries_,
+                        histogram_point_data.counts_,
+                        point_data_attr.attributes, scope, time,
+                        &metric_family, resource);
+            }
+            else if (type == prometheus_client::MetricType::Gauge)
+            {
+                if (nostd::holds_alternative<sdk::metrics::LastValuePointData>(
+                        point_data_attr.point_data))
+                {
+                    const auto& last_value_point_data =
+                        nostd::get<sdk::metrics::LastValuePointData>(
+                            point_data_attr.point_data);
+                    SetData(last_value_point_data.value_,
+                            point_data_attr.attributes, scope, type,
+                            time, &metric_family, resource);
+                }
+                else if (nostd::holds_alternative<sdk::metrics::SumPointData>(
+                             point_data_attr.point_data))
+                {
+                    const auto& sum_point_data =
+                        nostd::get<sdk::metrics::SumPointData>(
+                            point_data_attr.point_data);
+                    SetData(sum_point_data.value_,
+                            point_data_attr.attributes, scope, type,
+                            time, &metric_family, resource);
+                }
+                else
+                {
+                    OTEL_INTERNAL_LOG_WARN(
+                        "[Prometheus Exporter] TranslateToPrometheus - "
+                        "invalid LastValuePointData type");
+                }
+            }
+            else // Counter, Untyped
+            {
+                if (nostd::holds_alternative<sdk::metrics::SumPointData>(
+                        point_data_attr.point_data))
                 {
-                    is_monotonic =
-                        nostd::get<sdk::metrics::SumPointData>(front.point_data)
-                            .is_monotonic_;
+                    const auto& sum_point_data =
+                        nostd::get<sdk::metrics::SumPointData>(
+                            point_data_attr.point_data);
+                    SetData(sum_point_data.value_,
+                            point_data_attr.attributes, scope, type,
+                            time, &metric_family, resource);
                 }
-                const prometheus_client::MetricType type =
-                    TranslateType(kind, is_monotonic);
-                metric_family.name = MapToPrometheusName(
-                    metric_data.instrument_descriptor.name_,
-                    metric_data.instrument_descriptor.unit_, type);
-                metric_family.type = type;
-                const opentelemetry::sdk::instrumentationscope::
-                    InstrumentationScope* scope =
-                        without_otel_scope ? nullptr
-                                           : instrumentation_info.scope_;
-
-                for (const auto& point_data_attr : metric_data.point_data_attr_)
+                else
                 {
-                    if (type ==
-                        prometheus_client::MetricType::Histogram) // Histogram
-                    {
-                        auto histogram_point_data =
-                            nostd::get<sdk::metrics::HistogramPointData>(
-                                point_data_attr.point_data);
-                        auto boundaries = histogram_point_data.boundaries_;
-                        auto counts = histogram_point_data.counts_;
-                        double sum = 0.0;
-                        if (nostd::holds_alternative<double>(
-                                histogram_point_data.sum_))
-                        {
-                            sum = nostd::get<double>(histogram_point_data.sum_);
-                        }
-                        else
-                        {
-                            sum = static_cast<double>(
-                                nostd::get<int64_t>(histogram_point_data.sum_));
-                        }
-                        SetData(
-                            std::vector<double>{
-                                sum, (double)histogram_point_data.count_},
-                            boundaries, counts, point_data_attr.attributes,
-                            scope, time, &metric_family, data.resource_);
-                    }
-                    else if (type == prometheus_client::MetricType::Gauge)
-                    {
-                        if (nostd::holds_alternative<
-                                sdk::metrics::LastValuePointData>(
-                                point_data_attr.point_data))
-                        {
-                            auto last_value_point_data =
-                                nostd::get<sdk::metrics::LastValuePointData>(
-                                    point_data_attr.point_data);
-                            std::vector<metric_sdk::ValueType> values{
-                                last_value_point_data.value_};
-                            SetData(values, point_data_attr.attributes, scope,
-                                    type, time, &metric_family, data.resource_);
-                        }
-                        else if (nostd::holds_alternative<
-                                     sdk::metrics::SumPointData>(
-                                     point_data_attr.point_data))
-                        {
-                            auto sum_point_data =
-                                nostd::get<sdk::metrics::SumPointData>(
-                                    point_data_attr.point_data);
-                            std::vector<metric_sdk::ValueType> values{
-                                sum_point_data.value_};
-                            SetData(values, point_data_attr.attributes, scope,
-                                    type, time, &metric_family, data.resource_);
-                        }
-                        else
-                        {
-                            OTEL_INTERNAL_LOG_WARN(
-                                "[Prometheus Exporter] TranslateToPrometheus - "
-                                "invalid LastValuePointData type");
-                        }
-                    }
-                    else // Counter, Untyped
-                    {
-                        if (nostd::holds_alternative<
-                                sdk::metrics::SumPointData>(
-                                point_data_attr.point_data))
-                        {
-                            auto sum_point_data =
-                                nostd::get<sdk::metrics::SumPointData>(
-                                    point_data_attr.point_data);
-                            std::vector<metric_sdk::ValueType> values{
-                                sum_point_data.value_};
-                            SetData(values, point_data_attr.attributes, scope,
-                                    type, time, &metric_family, data.resource_);
-                        }
-                        else
-                        {
-                            OTEL_INTERNAL_LOG_WARN(
-                                "[Prometheus Exporter] TranslateToPrometheus - "
-                                "invalid SumPointData type");
-                        }
-                    }
+                    OTEL_INTERNAL_LOG_WARN(
+                        "[Prometheus Exporter] TranslateToPrometheus - "
+                        "invalid SumPointData type");
                 }
-                output.emplace_back(metric_family);
             }
         }
-        return output;
+        output->emplace_back(std::move(metric_family));
     }
 
+
     static void AddPrometheusLabel(
         std::string name, std::string value,
         std::vector<::prometheus::ClientMetric::Label>* labels)
@@ -272,41 +514,7 @@ struct PrometheusExporterUtils
      */
     static std::string SanitizeNames(std::string name)
     {
-        constexpr const auto replacement = '_';
-        constexpr const auto replacement_dup = '=';
-
-        auto valid = [](int i, char c) {
-            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == ':' ||
-                (c >= '0' && c <= '9' && i > 0))
-            {
-                return true;
-            }
-            return false;
-        };
-
-        bool has_dup = false;
-        for (int i = 0; i < (int)name.size(); ++i)
-        {
-            if (valid(i, name[i]))
-            {
-                continue;
-            }
-            if (i > 0 &&
-                (name[i - 1] == replacement || name[i - 1] == replacement_dup))
-            {
-                has_dup = true;
-                name[i] = replacement_dup;
-            }
-            else
-            {
-                name[i] = replacement;
-            }
-        }
-        if (has_dup)
-        {
-            auto end = std::remove(name.begin(), name.end(), replacement_dup);
-            return std::string{name.begin(), end};
-        }
+        name.resize(SanitizeNameInto(name, name.data()));
         return name;
     }
     static std::string
@@ -444,83 +652,9 @@ struct PrometheusExporterUtils
 
     static std::string CleanUpString(const std::string& str)
     {
-#if OPENTELEMETRY_HAVE_WORKING_REGEX
-        static std::regex INVALID_CHARACTERS_PATTERN("[^a-zA-Z0-9]");
-        static std::regex SANITIZE_LEADING_UNDERSCORES("^_+");
-        static std::regex SANITIZE_TRAILING_UNDERSCORES("_+$");
-        static std::regex SANITIZE_CONSECUTIVE_UNDERSCORES("[_]{2,}");
-        std::string cleaned_string =
-            std::regex_replace(str, INVALID_CHARACTERS_PATTERN, "_");
-        cleaned_string = std::regex_replace(
-            cleaned_string, SANITIZE_CONSECUTIVE_UNDERSCORES, "_");
-        cleaned_string = std::regex_replace(cleaned_string,
-                                            SANITIZE_TRAILING_UNDERSCORES, "");
-        cleaned_string = std::regex_replace(cleaned_string,
-                                            SANITIZE_LEADING_UNDERSCORES, "");
-        return cleaned_string;
-#else
-        std::string cleaned_string = str;
-        if (cleaned_string.empty())
-        {
-            return cleaned_string;
-        }
-        std::transform(cleaned_string.begin(), cleaned_string.end(),
-                       cleaned_string.begin(), [](const char c) {
-            if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
-                (c >= 'A' && c <= 'Z'))
-            {
-                return c;
-            }
-            return '_';
-        });
-
-        std::string::size_type trim_start = 0;
-        std::string::size_type trim_end = 0;
-        bool previous_underscore = false;
-        for (std::string::size_type i = 0; i < cleaned_string.size(); ++i)
-        {
-            if (cleaned_string[i] == '_')
-            {
-                if (previous_underscore)
-                {
-                    continue;
-                }
-
-                previous_underscore = true;
-            }
-            else
-            {
-                previous_underscore = false;
-            }
-
-            if (trim_end != i)
-            {
-                cleaned_string[trim_end] = cleaned_string[i];
-            }
-            ++trim_end;
-        }
-
-        while (trim_end > 0 && cleaned_string[trim_end - 1] == '_')
-        {
-            --trim_end;
-        }
-        while (trim_start < trim_end && cleaned_string[trim_start] == '_')
-        {
-            ++trim_start;
-        }
-
-        // All characters are underscore
-        if (trim_start >= trim_end)
-        {
-            return "_";
-        }
-        if (0 != trim_start || cleaned_string.size() != trim_end)
-        {
-            return cleaned_string.substr(trim_start, trim_end - trim_start);
-        }
-
+        std::string cleaned_string(str.size(), '\0');
+        cleaned_string.resize(CleanUpInto(str, cleaned_string.data()));
         return cleaned_string;
-#endif
     }
 
     static std::string
@@ -583,6 +717,12 @@ struct PrometheusExporterUtils
         {
             return metric_sdk::AggregationType::kLastValue;
         }
+        else if (nostd::holds_alternative<
+                     sdk::metrics::Base2ExponentialHistogramPointData>(
+                     point_type))
+        {
+            return metric_sdk::AggregationType::kBase2ExponentialHistogram;
+        }
         return metric_sdk::AggregationType::kDefault;
     }
 
@@ -605,6 +745,7 @@ struct PrometheusExporterUtils
                 }
                 break;
             case metric_sdk::AggregationType::kHistogram:
+            case metric_sdk::AggregationType::kBase2ExponentialHistogram:
                 return prometheus_client::MetricType::Histogram;
                 break;
             case metric_sdk::AggregationType::kLastValue:
@@ -653,9 +794,9 @@ struct PrometheusExporterUtils
      * Set metric data for:
      * sum => Prometheus Counter
      */
-    template <typename T>
     static void SetData(
-        std::vector<T> values, const metric_sdk::PointAttributes& labels,
+        const metric_sdk::ValueType& value,
+        const metric_sdk::PointAttributes& labels,
         const opentelemetry::sdk::instrumentationscope::InstrumentationScope*
             scope,
         prometheus_client::MetricType type, std::chrono::nanoseconds time,
@@ -665,16 +806,15 @@ struct PrometheusExporterUtils
         metric_family->metric.emplace_back();
         prometheus_client::ClientMetric& metric = metric_family->metric.back();
         SetMetricBasic(metric, labels, time, scope, resource);
-        SetValue(values, type, &metric);
+        SetValue(value, type, &metric);
     }
 
     /**
      * Set metric data for:
      * Histogram => Prometheus Histogram
      */
-    template <typename T>
     static void SetData(
-        std::vector<T> values, const std::vector<double>& boundaries,
+        double sum, std::uint64_t count, const std::vector<double>& boundaries,
         const std::vector<uint64_t>& counts,
         const metric_sdk::PointAttributes& labels,
         const opentelemetry::sdk::instrumentationscope::InstrumentationScope*
@@ -686,7 +826,7 @@ struct PrometheusExporterUtils
         metric_family->metric.emplace_back();
         prometheus_client::ClientMetric& metric = metric_family->metric.back();
         SetMetricBasic(metric, labels, time, scope, resource);
-        SetValue(values, boundaries, counts, &metric);
+        SetValue(sum, count, boundaries, counts, &metric);
     }
 
     /**
@@ -712,21 +852,22 @@ struct PrometheusExporterUtils
         // seems too expensive to do in this hot code path. Instead, we
         // ignore out-of-order keys and emit a warning.
         metric.label.reserve(labels.size() + 2);
-        std::string previous_key;
         for (const auto& label : labels)
         {
             auto sanitized = SanitizeLabel(label.first);
-            int comparison = previous_key.compare(sanitized);
-            if (metric.label.empty() || comparison < 0) // new key
+            int comparison = metric.label.empty()
+                                 ? -1
+                                 : metric.label.back().name.compare(sanitized);
+            if (comparison < 0) // new key
             {
-                previous_key = sanitized;
-                metric.label.push_back(
-                    {sanitized, AttributeValueToString(label.second)});
+                metric.label.push_back({std::move(sanitized),
+                                        AttributeValueToString(label.second)});
             }
             else if (comparison == 0) // key collision after sanitation
             {
-                metric.label.back().value +=
-                    ";" + AttributeValueToString(label.second);
+                auto& value = metric.label.back().value;
+                value += ';';
+                value += AttributeValueToString(label.second);
             }
             else // order inversion introduced by sanitation
             {
@@ -734,7 +875,7 @@ struct PrometheusExporterUtils
                     "[Prometheus Exporter] SetMetricBase - "
                     "the sort order of labels has changed because of sanitization: '"
                     << label.first << "' became '" << sanitized
-                    << "' which is less than '" << previous_key
+                    << "' which is less than '" << metric.label.back().name
                     << "'. Ignoring this label.");
             }
         }
@@ -802,13 +943,11 @@ struct PrometheusExporterUtils
     /**
      * Handle Counter.
      */
-    template <typename T>
-    static void SetValue(std::vector<T> values,
+    static void SetValue(const metric_sdk::ValueType& value_var,
                          prometheus_client::MetricType type,
                          prometheus_client::ClientMetric* metric)
     {
         double value = 0.0;
-        const auto& value_var = values[0];
         if (nostd::holds_alternative<int64_t>(value_var))
         {
             value = static_cast<double>(nostd::get<int64_t>(value_var));
@@ -843,16 +982,16 @@ struct PrometheusExporterUtils
     /**
      * Handle Histogram
      */
-    template <typename T>
-    static void SetValue(std::vector<T> values,
+    static void SetValue(double sum, std::uint64_t count,
                          const std::vector<double>& boundaries,
                          const std::vector<uint64_t>& counts,
                          prometheus_client::ClientMetric* metric)
     {
-        metric->histogram.sample_sum = static_cast<double>(values[0]);
-        metric->histogram.sample_count = static_cast<std::uint64_t>(values[1]);
+        metric->histogram.sample_sum = sum;
+        metric->histogram.sample_count = count;
         std::uint64_t cumulative = 0;
-        std::vector<prometheus_client::ClientMetric::Bucket> buckets;
+        auto& buckets = metric->histogram.bucket;
+        buckets.reserve(boundaries.size() + 1);
         uint32_t idx = 0;
         for (const auto& boundary : boundaries)
         {
@@ -868,7 +1007,204 @@ struct PrometheusExporterUtils
         bucket.cumulative_count = cumulative;
         bucket.upper_bound = std::numeric_limits<double>::infinity();
         buckets.emplace_back(bucket);
-        metric->histogram.bucket = buckets;
+    }
+
+    /**
+     * Set metric data for:
+     * QuantileInstrument => Prometheus Summary
+     */
+    static void
+        SetSummaries(const std::vector<QuantileSnapshot>& summaries,
+                     std::vector<prometheus_client::MetricFamily>* output)
+    {
+        for (const auto& summary : summaries)
+        {
+            prometheus_client::MetricFamily metric_family;
+            metric_family.name = GetNameCache().lookup(
+                summary.name, summary.unit,
+                prometheus_client::MetricType::Summary);
+            metric_family.help = summary.description;
+            metric_family.type = prometheus_client::MetricType::Summary;
+            auto& metric = metric_family.metric.emplace_back();
+            metric.summary.sample_count = summary.count;
+            metric.summary.sample_sum = summary.sum;
+            for (const auto& [quantile, value] : summary.quantiles)
+            {
+                prometheus_client::ClientMetric::Quantile q;
+                q.quantile = quantile;
+                q.value = value;
+                metric.summary.quantile.push_back(q);
+            }
+            output->emplace_back(std::move(metric_family));
+        }
+    }
+
+    /**
+     * Handle Base2ExponentialHistogram as a classic histogram, see
+     * ForEachExponentialBucket
+     */
+    static void SetValue(
+        const sdk::metrics::Base2ExponentialHistogramPointData& point,
+        std::int32_t export_scale, prometheus_client::ClientMetric* metric)
+    {
+        metric->histogram.sample_sum = point.sum_;
+        metric->histogram.sample_count = point.count_;
+        ForEachExponentialBucket(point, export_scale,
+                                 [metric](double upper_bound,
+                                          std::uint64_t cumulative) {
+            prometheus_client::ClientMetric::Bucket bucket;
+            bucket.cumulative_count = cumulative;
+            bucket.upper_bound = upper_bound;
+            metric->histogram.bucket.emplace_back(bucket);
+        });
+    }
+
+    /**
+     * Scale of the classic buckets exponential histograms are written with
+     * when their view sets none. Each bucket spans a factor of 2^(1/4), and
+     * a view's default 160 SDK buckets reach 2^40 before the SDK has to go
+     * below this scale.
+     */
+    static constexpr std::int32_t kExponentialBucketScale = 2;
+
+    /**
+     * Write the exponential histograms of metric `name` at `scale`, as set
+     * by the view that produces them
+     */
+    static void SetExponentialExportScale(std::string name,
+                                          std::int32_t scale)
+    {
+        auto& scales = ExponentialExportScales();
+        std::lock_guard<std::mutex> lock(scales.mutex);
+        scales.by_name[std::move(name)] = scale;
+    }
+
+    /**
+     * Scale exponential histograms of metric `name` are written with
+     */
+    static std::int32_t ExponentialExportScale(std::string_view name)
+    {
+        auto& scales = ExponentialExportScales();
+        std::lock_guard<std::mutex> lock(scales.mutex);
+        auto it = scales.by_name.find(name);
+        return it == scales.by_name.end() ? kExponentialBucketScale
+                                          : it->second;
+    }
+
+    /**
+     * Call `emit(upper_bound, cumulative_count)` for the buckets of an
+     * exponential histogram in ascending order, then for +Inf.
+     *
+     * The text exposition format has no native (sparse) histograms, so the
+     * exponential buckets become classic `le` buckets. For rate() and
+     * histogram_quantile() to work, the `le` bounds must not move between
+     * scrapes, while the SDK changes its scale as the recorded range grows.
+     * The buckets are therefore merged down to `export_scale`, fixed per
+     * view, whose bounds nest with every finer scale, and every bucket between
+     * the lowest and highest populated one is written, empty or not, as is
+     * the zero bucket. The layout then only grows at its ends, like the
+     * recorded range. A point whose SDK scale is already coarser is written
+     * at its own scale.
+     */
+    template <typename Emit>
+    static void ForEachExponentialBucket(
+        const sdk::metrics::Base2ExponentialHistogramPointData& point,
+        std::int32_t export_scale, Emit&& emit)
+    {
+        const std::int32_t scale = std::min(point.scale_, export_scale);
+        const std::int32_t shift = point.scale_ - scale;
+        // Bucket index i at scale s covers (base^i, base^(i+1)] with
+        // base = 2^(2^-s)
+        auto bound = [scale](std::int32_t index) {
+            return std::exp2(std::ldexp(static_cast<double>(index), -scale));
+        };
+        std::uint64_t cumulative = 0;
+        const auto& negative = Buckets(point.negative_buckets_);
+        if (!negative.Empty())
+        {
+            bool started = false;
+            std::int32_t current = 0;
+            for (auto index = negative.EndIndex();
+                 index >= negative.StartIndex(); --index)
+            {
+                auto count = negative.Get(index);
+                if (count == 0)
+                {
+                    continue;
+                }
+                const std::int32_t merged = index >> shift;
+                if (!started)
+                {
+                    current = merged;
+                    started = true;
+                }
+                for (; current > merged; --current)
+                {
+                    emit(-bound(current), cumulative);
+                }
+                cumulative += count;
+            }
+            if (started)
+            {
+                emit(-bound(current), cumulative);
+            }
+        }
+        cumulative += point.zero_count_;
+        emit(point.zero_threshold_, cumulative);
+        const auto& positive = Buckets(point.positive_buckets_);
+        if (!positive.Empty())
+        {
+            bool started = false;
+            std::int32_t current = 0;
+            for (auto index = positive.StartIndex();
+                 index <= positive.EndIndex(); ++index)
+            {
+                auto count = positive.Get(index);
+                if (count == 0)
+                {
+                    continue;
+                }
+                const std::int32_t merged = index >> shift;
+                if (!started)
+                {
+                    current = merged;
+                    started = true;
+                }
+                for (; current < merged; ++current)
+                {
+                    emit(bound(current + 1), cumulative);
+                }
+                cumulative += count;
+            }
+            if (started)
+            {
+                emit(bound(current + 1), cumulative);
+            }
+        }
+        emit(std::numeric_limits<double>::infinity(), point.count_);
+    }
+
+  private:
+    // The SDK has held the bucket counters both by value and by unique_ptr
+    template <typename Counter>
+    static const Counter& Buckets(const std::unique_ptr<Counter>& counter)
+    {
+        return *counter;
+    }
+    template <typename Counter>
+    static const Counter& Buckets(const Counter& counter)
+    {
+        return counter;
+    }
+    struct ExponentialScales
+    {
+        std::mutex mutex;
+        std::map<std::string, std::int32_t, std::less<>> by_name;
+    };
+    static ExponentialScales& ExponentialExportScales()
+    {
+        static ExponentialScales scales;
+        return scales;
     }
 };
 
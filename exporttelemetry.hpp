@@ -0,0 +1,319 @@
+#pragma once
+
+#include "opentelemetry/common/key_value_iterable_view.h"
+#include "opentelemetry/metrics/async_instruments.h"
+#include "opentelemetry/metrics/meter.h"
+#include "opentelemetry/metrics/observer_result.h"
+#include "opentelemetry/nostd/shared_ptr.h"
+#include "opentelemetry/nostd/variant.h"
+#include "opentelemetry/sdk/metrics/export/metric_producer.h"
+
+#include "cardinalitylimit.hpp"
+#include "quantilesketch.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace bmctelemetry
+{
+
+/**
+ * Cost of the metric export pipeline itself, filled in by the exporters and
+ * the push pipeline and reported by OtelMetrics as otel_exporter_* metrics.
+ *
+ * Durations and sizes are running totals, so rates and averages per export
+ * come from the usual Prometheus rate() arithmetic. Push round trips also
+ * go into a quantile instrument to show their tail.
+ */
+class ExportTelemetry
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Snapshot
+    {
+        std::uint64_t exports = 0;
+        std::uint64_t export_failures = 0;
+        std::chrono::nanoseconds translation_time{0};
+        std::chrono::nanoseconds serialization_time{0};
+        std::uint64_t payload_bytes = 0;
+        // Series in the most recent export
+        std::uint64_t last_series = 0;
+        // Overflow series of cardinality limited views in the most recent
+        // export
+        std::uint64_t last_overflow_series = 0;
+        std::uint64_t pushes_succeeded = 0;
+        std::uint64_t pushes_failed = 0;
+        std::chrono::nanoseconds round_trip_time{0};
+    };
+
+    ExportTelemetry() :
+        round_trip_(std::make_shared<QuantileInstrument>(
+            "otel_exporter_push_round_trip_seconds",
+            "HTTP round trip of metric pushes", "s",
+            std::vector<double>{0.5, 0.9, 0.99}))
+    {
+        QuantileRegistry::globalInstance().add(round_trip_);
+    }
+    ExportTelemetry(const ExportTelemetry&) = delete;
+    ExportTelemetry& operator=(const ExportTelemetry&) = delete;
+
+    void recordExport(bool success) noexcept
+    {
+        (success ? exports_ : export_failures_)
+            .fetch_add(1, std::memory_order_relaxed);
+    }
+    void recordTranslation(Clock::duration elapsed) noexcept
+    {
+        translation_ns_.fetch_add(nanoseconds(elapsed),
+                                  std::memory_order_relaxed);
+    }
+    void recordSerialization(Clock::duration elapsed) noexcept
+    {
+        serialization_ns_.fetch_add(nanoseconds(elapsed),
+                                    std::memory_order_relaxed);
+    }
+    void recordPayload(std::size_t bytes, std::size_t series,
+                       std::size_t overflow_series) noexcept
+    {
+        payload_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+        last_series_.store(series, std::memory_order_relaxed);
+        last_overflow_series_.store(overflow_series,
+                                    std::memory_order_relaxed);
+    }
+    void recordPush(bool success, Clock::duration round_trip)
+    {
+        if (!success)
+        {
+            pushes_failed_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        pushes_succeeded_.fetch_add(1, std::memory_order_relaxed);
+        round_trip_ns_.fetch_add(nanoseconds(round_trip),
+                                 std::memory_order_relaxed);
+        round_trip_->Record(
+            std::chrono::duration<double>(round_trip).count());
+    }
+
+    Snapshot snapshot() const noexcept
+    {
+        Snapshot s;
+        s.exports = exports_.load(std::memory_order_relaxed);
+        s.export_failures = export_failures_.load(std::memory_order_relaxed);
+        s.translation_time = std::chrono::nanoseconds(
+            translation_ns_.load(std::memory_order_relaxed));
+        s.serialization_time = std::chrono::nanoseconds(
+            serialization_ns_.load(std::memory_order_relaxed));
+        s.payload_bytes = payload_bytes_.load(std::memory_order_relaxed);
+        s.last_series = last_series_.load(std::memory_order_relaxed);
+        s.last_overflow_series =
+            last_overflow_series_.load(std::memory_order_relaxed);
+        s.pushes_succeeded = pushes_succeeded_.load(std::memory_order_relaxed);
+        s.pushes_failed = pushes_failed_.load(std::memory_order_relaxed);
+        s.round_trip_time = std::chrono::nanoseconds(
+            round_trip_ns_.load(std::memory_order_relaxed));
+        return s;
+    }
+
+    /**
+     * Series in `data`, one per point
+     */
+    static std::size_t
+        countSeries(const opentelemetry::sdk::metrics::ResourceMetrics& data)
+    {
+        std::size_t series = 0;
+        for (const auto& scope : data.scope_metric_data_)
+        {
+            for (const auto& metric : scope.metric_data_)
+            {
+                series += metric.point_data_attr_.size();
+            }
+        }
+        return series;
+    }
+
+    /**
+     * Points in `data` that the SDK filled with attribute sets beyond a
+     * view's cardinality limit
+     */
+    static std::size_t countOverflowSeries(
+        const opentelemetry::sdk::metrics::ResourceMetrics& data)
+    {
+        std::size_t series = 0;
+        for (const auto& scope : data.scope_metric_data_)
+        {
+            for (const auto& metric : scope.metric_data_)
+            {
+                for (const auto& point : metric.point_data_attr_)
+                {
+                    series += point.attributes.count(kOverflowAttribute);
+                }
+            }
+        }
+        return series;
+    }
+
+  private:
+    static std::uint64_t nanoseconds(Clock::duration elapsed) noexcept
+    {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                .count());
+    }
+
+    std::atomic<std::uint64_t> exports_{0};
+    std::atomic<std::uint64_t> export_failures_{0};
+    std::atomic<std::uint64_t> translation_ns_{0};
+    std::atomic<std::uint64_t> serialization_ns_{0};
+    std::atomic<std::uint64_t> payload_bytes_{0};
+    std::atomic<std::uint64_t> last_series_{0};
+    std::atomic<std::uint64_t> last_overflow_series_{0};
+    std::atomic<std::uint64_t> pushes_succeeded_{0};
+    std::atomic<std::uint64_t> pushes_failed_{0};
+    std::atomic<std::uint64_t> round_trip_ns_{0};
+    std::shared_ptr<QuantileInstrument> round_trip_;
+};
+
+/**
+ * Reports an ExportTelemetry through observable instruments of `meter`:
+ * otel_exporter_exports{result}, otel_exporter_pushes{result},
+ * otel_exporter_time{stage}, otel_exporter_payload and the
+ * otel_exporter_series and otel_exporter_overflow_series gauges, alongside
+ * the round trip summary.
+ */
+class ExportTelemetryMetrics
+{
+  public:
+    ExportTelemetryMetrics(
+        const opentelemetry::nostd::shared_ptr<opentelemetry::metrics::Meter>&
+            meter,
+        std::shared_ptr<ExportTelemetry> telemetry) :
+        telemetry_(std::move(telemetry))
+    {
+        add(meter->CreateDoubleObservableCounter(
+                "otel_exporter_exports", "Metric exports by result"),
+            observeExports);
+        add(meter->CreateDoubleObservableCounter(
+                "otel_exporter_pushes", "Payloads pushed by result"),
+            observePushes);
+        add(meter->CreateDoubleObservableCounter(
+                "otel_exporter_time",
+                "Time spent translating and serializing metrics", "s"),
+            observeTime);
+        add(meter->CreateDoubleObservableCounter(
+                "otel_exporter_payload", "Serialized payload size", "By"),
+            observePayload);
+        add(meter->CreateDoubleObservableGauge(
+                "otel_exporter_series", "Series in the latest export"),
+            observeSeries);
+        add(meter->CreateDoubleObservableGauge(
+                "otel_exporter_overflow_series",
+                "Series over a view's cardinality limit in the latest export"),
+            observeOverflowSeries);
+    }
+    ExportTelemetryMetrics(const ExportTelemetryMetrics&) = delete;
+    ExportTelemetryMetrics& operator=(const ExportTelemetryMetrics&) = delete;
+    ~ExportTelemetryMetrics()
+    {
+        for (auto& [instrument, callback] : instruments_)
+        {
+            instrument->RemoveCallback(callback, telemetry_.get());
+        }
+    }
+
+  private:
+    using Instrument = opentelemetry::nostd::shared_ptr<
+        opentelemetry::metrics::ObservableInstrument>;
+    using Result = opentelemetry::metrics::ObserverResult;
+    using Callback = void (*)(Result, void*);
+
+    void add(Instrument instrument, Callback callback)
+    {
+        instrument->AddCallback(callback, telemetry_.get());
+        instruments_.emplace_back(std::move(instrument), callback);
+    }
+
+    static ExportTelemetry::Snapshot snapshot(void* state)
+    {
+        return static_cast<ExportTelemetry*>(state)->snapshot();
+    }
+
+    static void observe(Result& result, double value, const char* key,
+                        const char* attribute)
+    {
+        using DoubleResult = opentelemetry::nostd::shared_ptr<
+            opentelemetry::metrics::ObserverResultT<double>>;
+        if (!opentelemetry::nostd::holds_alternative<DoubleResult>(result))
+        {
+            return;
+        }
+        auto& observer = opentelemetry::nostd::get<DoubleResult>(result);
+        if (key == nullptr)
+        {
+            observer->Observe(value);
+            return;
+        }
+        std::array<std::pair<opentelemetry::nostd::string_view,
+                             opentelemetry::common::AttributeValue>,
+                   1>
+            attributes{{{key, attribute}}};
+        observer->Observe(
+            value, opentelemetry::common::KeyValueIterableView<
+                       decltype(attributes)>{attributes});
+    }
+
+    static double seconds(std::chrono::nanoseconds time)
+    {
+        return std::chrono::duration<double>(time).count();
+    }
+
+    static void observeExports(Result result, void* state)
+    {
+        auto s = snapshot(state);
+        observe(result, static_cast<double>(s.exports), "result", "success");
+        observe(result, static_cast<double>(s.export_failures), "result",
+                "failure");
+    }
+    static void observePushes(Result result, void* state)
+    {
+        auto s = snapshot(state);
+        observe(result, static_cast<double>(s.pushes_succeeded), "result",
+                "success");
+        observe(result, static_cast<double>(s.pushes_failed), "result",
+                "failure");
+    }
+    static void observeTime(Result result, void* state)
+    {
+        auto s = snapshot(state);
+        observe(result, seconds(s.translation_time), "stage", "translation");
+        observe(result, seconds(s.serialization_time), "stage",
+                "serialization");
+    }
+    static void observePayload(Result result, void* state)
+    {
+        observe(result, static_cast<double>(snapshot(state).payload_bytes),
+                nullptr, nullptr);
+    }
+    static void observeSeries(Result result, void* state)
+    {
+        observe(result, static_cast<double>(snapshot(state).last_series),
+                nullptr, nullptr);
+    }
+
+    static void observeOverflowSeries(Result result, void* state)
+    {
+        observe(result,
+                static_cast<double>(snapshot(state).last_overflow_series),
+                nullptr, nullptr);
+    }
+
+    std::shared_ptr<ExportTelemetry> telemetry_;
+    std::vector<std::pair<Instrument, Callback>> instruments_;
+};
+
+} // namespace bmctelemetry
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "client/http/http_subscriber.hpp"
+#include "opentelemetry/sdk/common/global_log_handler.h"
+
+#include <boost/asio/ssl.hpp>
+#include <boost/beast/http.hpp>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace bmctelemetry
+{
+
+/**
+ * An HttpSubscriber that can send a request with its own method and headers
+ */
+template <typename Subscriber>
+concept SendsWithHeaders = requires(Subscriber& subscriber, std::string body,
+                                    boost::beast::http::verb method,
+                                    boost::beast::http::fields headers) {
+    subscriber.sendEvent(std::move(body), method, std::move(headers));
+};
+
+/**
+ * Thin adapter the push pipeline sends through. The reactor's
+ * HttpSubscriber owns the connection, TLS and retry policy; this only maps
+ * a send onto it and reports the answer.
+ *
+ * Method and headers need an HttpSubscriber::sendEvent overload that takes
+ * them. Reactors without one POST every body as is and kSendsHeaders is
+ * false, so callers must not compress. HttpSubscriber reports no failures,
+ * so a send that never completes is left to the caller's timeout.
+ */
+class HttpPushClient
+{
+  public:
+    using Completion = std::function<void(bool success)>;
+
+    static constexpr bool kSendsHeaders =
+        SendsWithHeaders<reactor::HttpSubscriber>;
+
+    /**
+     * `url` is http://host[:port]/path or https://..., as passed to the
+     * exporters. The gateway certificate is checked against the system
+     * store when `verify_peer` is set.
+     */
+    HttpPushClient(boost::asio::io_context::executor_type ex,
+                   const std::string& url, bool verify_peer = false) :
+        subscriber_(ex, url), state_(std::make_shared<State>())
+    {
+        boost::asio::ssl::context ctx{
+            boost::asio::ssl::context::tlsv12_client};
+        if (verify_peer)
+        {
+            ctx.set_default_verify_paths();
+            ctx.set_verify_mode(boost::asio::ssl::verify_peer);
+        }
+        else
+        {
+            ctx.set_verify_mode(boost::asio::ssl::verify_none);
+        }
+        subscriber_.withSslContext(std::move(ctx));
+        subscriber_.withPoolSize(1);
+        subscriber_.withPolicy({.maxRetries = 1});
+        subscriber_.withSuccessHandler(
+            [state = state_](const auto&, const auto& response) {
+            // With a pool of one, the answer is for the latest send. A late
+            // answer for a send that timed out completes the next one.
+            Completion completion = std::move(state->completion);
+            state->completion = nullptr;
+            if (!completion)
+            {
+                return;
+            }
+            bool success = true;
+            if constexpr (requires { response.result_int(); })
+            {
+                success = response.result_int() / 100 == 2;
+            }
+            completion(success);
+        });
+    }
+
+    /**
+     * Send `body` with `method` and `headers`. Must run on the io_context,
+     * where `completion` runs too, at most once.
+     */
+    void send(boost::beast::http::verb method, std::string body,
+              boost::beast::http::fields headers, Completion completion)
+    {
+        state_->completion = std::move(completion);
+        sendEvent(subscriber_, method, std::move(body), std::move(headers));
+    }
+
+  private:
+    struct State
+    {
+        Completion completion;
+    };
+
+    template <typename Subscriber>
+    static void sendEvent(Subscriber& subscriber,
+                          boost::beast::http::verb method, std::string body,
+                          boost::beast::http::fields headers)
+    {
+        if constexpr (SendsWithHeaders<Subscriber>)
+        {
+            subscriber.sendEvent(std::move(body), method, std::move(headers));
+        }
+        else
+        {
+            subscriber.sendEvent(std::move(body));
+        }
+    }
+
+    reactor::HttpSubscriber subscriber_;
+    // Shared with the success handler, which HttpSubscriber may keep
+    std::shared_ptr<State> state_;
+};
+
+} // namespace bmctelemetry
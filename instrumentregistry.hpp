@@ -0,0 +1,240 @@
+#pragma once
+
+#include "opentelemetry/metrics/async_instruments.h"
+#include "opentelemetry/metrics/sync_instruments.h"
+#include "opentelemetry/nostd/shared_ptr.h"
+#include "opentelemetry/nostd/unique_ptr.h"
+#include "opentelemetry/sdk/common/global_log_handler.h"
+
+#include "boundinstruments.hpp"
+#include "quantilesketch.hpp"
+#include "shardedcounter.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace bmctelemetry
+{
+
+enum class InstrumentKind : std::uint8_t
+{
+    DoubleCounter,
+    DoubleObservableCounter,
+    DoubleHistogram,
+    ShardedCounter,
+    BoundCounter,
+    Quantile,
+};
+
+/**
+ * Caches instruments by (meter, instrument name, kind, unit) so asking for
+ * the same instrument again returns the handle created the first time.
+ *
+ * Entries live in an open addressing table of atomic pointers. Lookups of
+ * existing instruments only do atomic loads and string_view compares; the
+ * mutex is taken only to create an instrument. The table is replaced by a
+ * larger copy when half full, and old tables are kept until the registry
+ * goes away so concurrent lookups never see freed memory.
+ */
+class InstrumentRegistry
+{
+  public:
+    using Handle = std::variant<
+        std::monostate,
+        opentelemetry::nostd::unique_ptr<
+            opentelemetry::metrics::Counter<double>>,
+        opentelemetry::nostd::shared_ptr<
+            opentelemetry::metrics::ObservableInstrument>,
+        std::shared_ptr<opentelemetry::metrics::Histogram<double>>,
+        std::shared_ptr<ShardedCounter>, std::shared_ptr<BoundCounterFamily>,
+        std::shared_ptr<QuantileInstrument>>;
+
+    struct Key
+    {
+        std::string_view meter;
+        std::string_view name;
+        std::string_view unit;
+        InstrumentKind kind;
+    };
+
+    InstrumentRegistry()
+    {
+        tables_.push_back(std::make_unique<Table>(kInitialCapacity));
+        table_.store(tables_.back().get(), std::memory_order_release);
+    }
+    InstrumentRegistry(const InstrumentRegistry&) = delete;
+    InstrumentRegistry& operator=(const InstrumentRegistry&) = delete;
+
+    /**
+     * Handle registered under `key`, calling `create` to make it the first
+     * time the key is seen. A bound counter reports through an observable
+     * counter of its own, so it cannot share its name with any other kind,
+     * nor a plain counter with it; such a key gets an empty handle.
+     */
+    template <typename Create>
+    const Handle& getOrCreate(const Key& key, Create&& create)
+    {
+        const auto hash = hashKey(key);
+        if (const auto* entry =
+                find(*table_.load(std::memory_order_acquire), key, hash))
+        {
+            return entry->handle;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (const auto* entry =
+                find(*table_.load(std::memory_order_relaxed), key, hash))
+        {
+            return entry->handle;
+        }
+        if (conflicts(key))
+        {
+            OTEL_INTERNAL_LOG_ERROR("[Instrument Registry] "
+                                    << key.name
+                                    << " is a bound counter and a plain "
+                                       "instrument at once, not creating it");
+            return rejected_;
+        }
+        auto entry = std::make_unique<Entry>(key, hash);
+        entry->handle = std::forward<Create>(create)();
+        insert(entry.get());
+        entries_.push_back(std::move(entry));
+        return entries_.back()->handle;
+    }
+
+    /**
+     * Release all instruments. Must not race with getOrCreate; meant for
+     * tearing down before the meter provider goes away.
+     */
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tables_.clear();
+        entries_.clear();
+        tables_.push_back(std::make_unique<Table>(kInitialCapacity));
+        table_.store(tables_.back().get(), std::memory_order_release);
+    }
+
+  private:
+    static constexpr std::size_t kInitialCapacity = 64;
+
+    struct Entry
+    {
+        Entry(const Key& key, std::size_t keyHash) :
+            meter(key.meter), name(key.name), unit(key.unit), kind(key.kind),
+            hash(keyHash)
+        {}
+        bool matches(const Key& key, std::size_t keyHash) const noexcept
+        {
+            return hash == keyHash && kind == key.kind && name == key.name &&
+                   meter == key.meter && unit == key.unit;
+        }
+
+        std::string meter;
+        std::string name;
+        std::string unit;
+        InstrumentKind kind;
+        std::size_t hash;
+        Handle handle;
+    };
+
+    struct Table
+    {
+        explicit Table(std::size_t capacity) :
+            mask(capacity - 1),
+            slots(std::make_unique<std::atomic<Entry*>[]>(capacity))
+        {}
+        const std::size_t mask;
+        std::unique_ptr<std::atomic<Entry*>[]> slots;
+    };
+
+    static std::size_t hashKey(const Key& key) noexcept
+    {
+        std::hash<std::string_view> hasher;
+        std::size_t hash = hasher(key.name);
+        hash = hash * 31 + hasher(key.meter);
+        hash = hash * 31 + hasher(key.unit);
+        return hash * 31 + static_cast<std::size_t>(key.kind);
+    }
+
+    static const Entry* find(const Table& table, const Key& key,
+                             std::size_t hash) noexcept
+    {
+        for (std::size_t i = hash & table.mask;; i = (i + 1) & table.mask)
+        {
+            const Entry* entry =
+                table.slots[i].load(std::memory_order_acquire);
+            if (entry == nullptr)
+            {
+                return nullptr;
+            }
+            if (entry->matches(key, hash))
+            {
+                return entry;
+            }
+        }
+    }
+
+    // Called with mutex_ held
+    bool conflicts(const Key& key) const
+    {
+        for (const auto& entry : entries_)
+        {
+            if (entry->name != key.name || entry->meter != key.meter ||
+                entry->kind == key.kind)
+            {
+                continue;
+            }
+            if (key.kind == InstrumentKind::BoundCounter ||
+                (key.kind == InstrumentKind::DoubleCounter &&
+                 entry->kind == InstrumentKind::BoundCounter))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void place(Table& table, Entry* entry) noexcept
+    {
+        std::size_t i = entry->hash & table.mask;
+        while (table.slots[i].load(std::memory_order_relaxed) != nullptr)
+        {
+            i = (i + 1) & table.mask;
+        }
+        table.slots[i].store(entry, std::memory_order_release);
+    }
+
+    // Called with mutex_ held
+    void insert(Entry* entry)
+    {
+        Table* table = table_.load(std::memory_order_relaxed);
+        if ((entries_.size() + 1) * 2 > table->mask + 1)
+        {
+            auto larger = std::make_unique<Table>((table->mask + 1) * 2);
+            for (const auto& existing : entries_)
+            {
+                place(*larger, existing.get());
+            }
+            table = larger.get();
+            tables_.push_back(std::move(larger));
+        }
+        place(*table, entry);
+        table_.store(table, std::memory_order_release);
+    }
+
+    std::atomic<Table*> table_{nullptr};
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Table>> tables_;
+    std::vector<std::unique_ptr<Entry>> entries_;
+    const Handle rejected_{};
+};
+
+} // namespace bmctelemetry
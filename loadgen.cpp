@@ -0,0 +1,446 @@
+// Load generator for the metrics pipeline. N threads drive counters,
+// observable counters and histograms at a target rate over a configurable
+// number of attribute sets, while the normal OtelMetrics export runs. It
+// reports Add/Record latency percentiles, achieved throughput, export cost
+// and RSS, to find where the pipeline saturates on a given machine.
+
+constexpr const char* libraryname = "otelloadgen";
+#include "otelapi.hpp"
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace bmctelemetry;
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+struct LoadOptions
+{
+    std::size_t threads = 4;
+    // Operations per second over all threads; 0 runs flat out
+    double rate = 0;
+    std::chrono::seconds duration{30};
+    // Distinct attribute sets per instrument
+    std::size_t cardinality = 16;
+    bool counter = true;
+    bool observable = true;
+    bool histogram = true;
+    std::chrono::milliseconds export_interval{1000};
+    std::chrono::seconds report_interval{5};
+    // Push to this url when set, otherwise serve /metrics on
+    // 127.0.0.1:pull_port
+    std::string url;
+    unsigned short pull_port = 9464;
+};
+
+enum Kind : std::size_t
+{
+    kCounter,
+    kObservable,
+    kHistogram,
+    kKinds,
+};
+
+constexpr const char* kKindNames[kKinds] = {"counter Add", "observable store",
+                                            "histogram Record"};
+
+using Labels = std::map<std::string, std::string>;
+
+/**
+ * Values behind the observable counter, one per attribute set, reported by
+ * its callback at each collection
+ */
+struct ObservedCells
+{
+    explicit ObservedCells(const std::vector<Labels>& sets) :
+        labels(sets), values(sets.size())
+    {}
+
+    static void observe(metrics_api::ObserverResult result, void* state)
+    {
+        using DoubleResult =
+            nostd::shared_ptr<metrics_api::ObserverResultT<double>>;
+        if (!nostd::holds_alternative<DoubleResult>(result))
+        {
+            return;
+        }
+        auto& observer = nostd::get<DoubleResult>(result);
+        auto* cells = static_cast<ObservedCells*>(state);
+        for (std::size_t i = 0; i < cells->values.size(); ++i)
+        {
+            observer->Observe(
+                cells->values[i].load(std::memory_order_relaxed),
+                common::KeyValueIterableView<Labels>{cells->labels[i]});
+        }
+    }
+
+    const std::vector<Labels>& labels;
+    std::vector<std::atomic<double>> values;
+};
+
+/**
+ * What one worker thread measured, on its own cache lines
+ */
+struct alignas(64) WorkerResult
+{
+    std::array<QuantileSketch, kKinds> latency;
+    std::array<std::uint64_t, kKinds> ops{};
+};
+
+struct Instruments
+{
+    metrics_api::Counter<double>* counter = nullptr;
+    metrics_api::Histogram<double>* histogram = nullptr;
+    ObservedCells* cells = nullptr;
+    const std::vector<Labels>* labels = nullptr;
+};
+
+void worker(const LoadOptions& options, const Instruments& instruments,
+            const std::atomic<bool>& stop, std::atomic<std::uint64_t>& total,
+            std::size_t index, WorkerResult& result)
+{
+    std::vector<Kind> kinds;
+    if (options.counter)
+    {
+        kinds.push_back(kCounter);
+    }
+    if (options.observable)
+    {
+        kinds.push_back(kObservable);
+    }
+    if (options.histogram)
+    {
+        kinds.push_back(kHistogram);
+    }
+    const auto& labels = *instruments.labels;
+    const auto context = opentelemetry::context::Context{};
+    const auto interval =
+        options.rate > 0
+            ? std::chrono::duration_cast<Clock::duration>(
+                  std::chrono::duration<double>(
+                      static_cast<double>(options.threads) / options.rate))
+            : Clock::duration::zero();
+    auto next = Clock::now();
+    std::uint64_t local = 0;
+
+    for (std::size_t i = index; !stop.load(std::memory_order_relaxed); ++i)
+    {
+        if (interval != Clock::duration::zero())
+        {
+            // Fixed schedule: a thread that falls behind catches up
+            // instead of lowering the rate
+            next += interval;
+            if (Clock::now() < next)
+            {
+                std::this_thread::sleep_until(next);
+            }
+        }
+        const auto kind = kinds[i % kinds.size()];
+        const auto set = (i / kinds.size()) % labels.size();
+        const auto value = static_cast<double>(i % 1000);
+        common::KeyValueIterableView<Labels> attributes{labels[set]};
+
+        const auto start = Clock::now();
+        switch (kind)
+        {
+            case kCounter:
+                instruments.counter->Add(value, attributes);
+                break;
+            case kObservable:
+                instruments.cells->values[set].fetch_add(
+                    value, std::memory_order_relaxed);
+                break;
+            case kHistogram:
+                instruments.histogram->Record(value, attributes, context);
+                break;
+            default:
+                break;
+        }
+        const auto elapsed = Clock::now() - start;
+        result.latency[kind].record(static_cast<double>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                .count()));
+        ++result.ops[kind];
+        if (++local % 1024 == 0)
+        {
+            total.fetch_add(1024, std::memory_order_relaxed);
+        }
+    }
+    total.fetch_add(local % 1024, std::memory_order_relaxed);
+}
+
+/**
+ * Resident and peak resident set size in KiB
+ */
+std::pair<std::uint64_t, std::uint64_t> memoryKiB()
+{
+    std::uint64_t pages = 0;
+    std::uint64_t resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return {resident * static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE)) /
+                1024,
+            static_cast<std::uint64_t>(usage.ru_maxrss)};
+}
+
+void progress(double seconds, std::uint64_t ops, double rate,
+              const ExportTelemetry::Snapshot& now,
+              const ExportTelemetry::Snapshot& before)
+{
+    const auto exports = now.exports - before.exports;
+    const auto exportTime = (now.translation_time - before.translation_time) +
+                            (now.serialization_time -
+                             before.serialization_time);
+    const auto [rss, peak] = memoryKiB();
+    std::printf(
+        "t=%5.1fs ops=%llu rate=%.0f/s rss=%llu KiB peak=%llu KiB "
+        "exports=%llu export=%.2f ms payload=%llu B series=%llu "
+        "pushes ok/failed=%llu/%llu\n",
+        seconds, static_cast<unsigned long long>(ops), rate,
+        static_cast<unsigned long long>(rss),
+        static_cast<unsigned long long>(peak),
+        static_cast<unsigned long long>(exports),
+        exports != 0
+            ? std::chrono::duration<double, std::milli>(exportTime).count() /
+                  static_cast<double>(exports)
+            : 0.0,
+        static_cast<unsigned long long>(
+            exports != 0 ? (now.payload_bytes - before.payload_bytes) / exports
+                         : 0),
+        static_cast<unsigned long long>(now.last_series),
+        static_cast<unsigned long long>(now.pushes_succeeded),
+        static_cast<unsigned long long>(now.pushes_failed));
+    std::fflush(stdout);
+}
+
+void usage(const char* program)
+{
+    std::fprintf(
+        stderr,
+        "usage: %s [--threads N] [--rate OPS_PER_SEC] [--duration S]\n"
+        "          [--cardinality N] [--instruments counter,observable,"
+        "histogram]\n"
+        "          [--export-interval MS] [--report-interval S]\n"
+        "          [--url PUSH_URL | --pull-port PORT]\n",
+        program);
+}
+
+bool parse(int argc, char** argv, LoadOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+        const char* value = argv[++i];
+        const auto number = std::strtoull(value, nullptr, 10);
+        if (std::strcmp(arg, "--threads") == 0)
+        {
+            options.threads = std::max<std::size_t>(number, 1);
+        }
+        else if (std::strcmp(arg, "--rate") == 0)
+        {
+            options.rate = std::strtod(value, nullptr);
+        }
+        else if (std::strcmp(arg, "--duration") == 0)
+        {
+            options.duration = std::chrono::seconds(number);
+        }
+        else if (std::strcmp(arg, "--cardinality") == 0)
+        {
+            options.cardinality = std::max<std::size_t>(number, 1);
+        }
+        else if (std::strcmp(arg, "--instruments") == 0)
+        {
+            options.counter = options.observable = options.histogram = false;
+            std::string_view list = value;
+            while (!list.empty())
+            {
+                const auto comma = std::min(list.find(','), list.size());
+                const auto name = list.substr(0, comma);
+                options.counter |= name == "counter";
+                options.observable |= name == "observable";
+                options.histogram |= name == "histogram";
+                list.remove_prefix(std::min(comma + 1, list.size()));
+            }
+        }
+        else if (std::strcmp(arg, "--export-interval") == 0)
+        {
+            options.export_interval =
+                std::chrono::milliseconds(std::max<std::uint64_t>(number, 1));
+        }
+        else if (std::strcmp(arg, "--report-interval") == 0)
+        {
+            options.report_interval =
+                std::chrono::seconds(std::max<std::uint64_t>(number, 1));
+        }
+        else if (std::strcmp(arg, "--url") == 0)
+        {
+            options.url = value;
+        }
+        else if (std::strcmp(arg, "--pull-port") == 0)
+        {
+            options.pull_port = static_cast<unsigned short>(number);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return options.counter || options.observable || options.histogram;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    LoadOptions options;
+    if (!parse(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // Outlives the metrics singleton, which keeps its executor
+    static net::io_context ioContext;
+    auto work = net::make_work_guard(ioContext);
+    std::thread io([] { ioContext.run(); });
+
+    auto& builder = OtelMetrics::OtelMetricsBuilder::globalInstance()
+                        .withContext(ioContext)
+                        .withExportInterval(options.export_interval);
+    if (options.url.empty())
+    {
+        builder.withPullEndpoint({.port = options.pull_port});
+    }
+    else
+    {
+        builder.withUrl(options.url);
+    }
+    auto& metrics = builder.getMetrics();
+
+    std::vector<Labels> labels;
+    labels.reserve(options.cardinality);
+    for (std::size_t i = 0; i < options.cardinality; ++i)
+    {
+        labels.push_back(
+            {{"series", std::to_string(i)}, {"source", "loadgen"}});
+    }
+    ObservedCells cells(labels);
+    Instruments instruments{
+        metrics.createDoubleCounter("loadgen_counter"),
+        metrics.createDoubleHistogram("loadgen_histogram", "Load generator",
+                                      "ms"),
+        &cells, &labels};
+    auto observable =
+        metrics.createDoubleObservableCounter("loadgen_observable_counter");
+    observable->AddCallback(ObservedCells::observe, &cells);
+
+    const auto target =
+        options.rate > 0
+            ? std::to_string(static_cast<std::uint64_t>(options.rate)) +
+                  " ops/s"
+            : std::string("unthrottled");
+    std::printf("%zu threads, %s, %zu attribute sets, export every %lld ms\n",
+                options.threads, target.c_str(),
+                options.cardinality,
+                static_cast<long long>(options.export_interval.count()));
+
+    std::atomic<bool> stop{false};
+    std::atomic<std::uint64_t> total{0};
+    std::vector<WorkerResult> results(options.threads);
+    std::vector<std::thread> workers;
+    const auto start = Clock::now();
+    for (std::size_t t = 0; t < options.threads; ++t)
+    {
+        workers.emplace_back(worker, std::cref(options), std::cref(instruments),
+                             std::cref(stop), std::ref(total), t,
+                             std::ref(results[t]));
+    }
+
+    const auto end = start + options.duration;
+    auto lastReport = start;
+    auto lastOps = std::uint64_t{0};
+    auto lastExport = metrics.exportTelemetry->snapshot();
+    while (Clock::now() < end)
+    {
+        std::this_thread::sleep_until(
+            std::min(end, lastReport + options.report_interval));
+        const auto now = Clock::now();
+        const auto ops = total.load(std::memory_order_relaxed);
+        const auto exported = metrics.exportTelemetry->snapshot();
+        progress(std::chrono::duration<double>(now - start).count(), ops,
+                 static_cast<double>(ops - lastOps) /
+                     std::chrono::duration<double>(now - lastReport).count(),
+                 exported, lastExport);
+        lastReport = now;
+        lastOps = ops;
+        lastExport = exported;
+    }
+    stop.store(true, std::memory_order_relaxed);
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
+    const auto elapsed =
+        std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Export and shut down while the io_context still runs the pushes
+    metrics.p->ForceFlush();
+    observable->RemoveCallback(ObservedCells::observe, &cells);
+    metrics.p->Shutdown();
+    work.reset();
+    ioContext.stop();
+    io.join();
+
+    std::printf("\n%-18s %12s %12s %10s %10s %10s %10s %10s\n", "operation",
+                "ops", "ops/s", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns",
+                "max ns");
+    std::uint64_t all = 0;
+    for (std::size_t kind = 0; kind < kKinds; ++kind)
+    {
+        QuantileSketch merged;
+        std::uint64_t ops = 0;
+        for (const auto& result : results)
+        {
+            merged.merge(result.latency[kind]);
+            ops += result.ops[kind];
+        }
+        if (ops == 0)
+        {
+            continue;
+        }
+        all += ops;
+        std::printf("%-18s %12llu %12.0f %10.0f %10.0f %10.0f %10.0f %10.0f\n",
+                    kKindNames[kind], static_cast<unsigned long long>(ops),
+                    static_cast<double>(ops) / elapsed, merged.quantile(0.5),
+                    merged.quantile(0.9), merged.quantile(0.99),
+                    merged.quantile(0.999), merged.quantile(1.0));
+    }
+    const auto [rss, peak] = memoryKiB();
+    std::printf("total %llu ops in %.1f s = %.0f ops/s, rss %llu KiB, peak "
+                "%llu KiB\n",
+                static_cast<unsigned long long>(all), elapsed,
+                static_cast<double>(all) / elapsed,
+                static_cast<unsigned long long>(rss),
+                static_cast<unsigned long long>(peak));
+    return 0;
+}
@@ -0,0 +1,256 @@
+#pragma once
+
+#include "opentelemetry/sdk/common/global_log_handler.h"
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace bmctelemetry
+{
+
+/**
+ * Holds the most recently serialized metrics payload. The exporter replaces
+ * it atomically on every collection and scrapers share it without copying.
+ */
+class MetricsSnapshot
+{
+  public:
+    using Payload = std::shared_ptr<const std::string>;
+
+    void store(std::string payload)
+    {
+        payload_.store(std::make_shared<const std::string>(std::move(payload)),
+                       std::memory_order_release);
+    }
+    Payload load() const
+    {
+        return payload_.load(std::memory_order_acquire);
+    }
+
+  private:
+    std::atomic<Payload> payload_{std::make_shared<const std::string>()};
+};
+
+/**
+ * Minimal HTTP/1.1 server answering GET requests on one path with the
+ * current MetricsSnapshot. Runs entirely on the given io_context; a scrape
+ * only writes out the already serialized payload.
+ *
+ * A connection that sends nothing for idle_timeout is closed, and so is one
+ * that takes longer than read_timeout to finish a request or to take its
+ * response, so stalled or idle keep-alive clients cannot pile up.
+ */
+class MetricsHttpServer : public std::enable_shared_from_this<MetricsHttpServer>
+{
+    using tcp = boost::asio::ip::tcp;
+
+  public:
+    MetricsHttpServer(boost::asio::io_context::executor_type ex,
+                      const tcp::endpoint& endpoint, std::string path,
+                      std::shared_ptr<MetricsSnapshot> snapshot,
+                      std::chrono::seconds idle_timeout,
+                      std::chrono::seconds read_timeout) :
+        acceptor_(ex), endpoint_(endpoint), path_(std::move(path)),
+        snapshot_(std::move(snapshot)), idle_timeout_(idle_timeout),
+        read_timeout_(read_timeout)
+    {}
+
+    /**
+     * Bind the listening socket and start accepting scrapers
+     *
+     * @return false if the endpoint could not be bound
+     */
+    bool start()
+    {
+        boost::system::error_code ec;
+        acceptor_.open(endpoint_.protocol(), ec);
+        if (!ec)
+        {
+            acceptor_.set_option(tcp::acceptor::reuse_address(true), ec);
+        }
+        if (!ec)
+        {
+            acceptor_.bind(endpoint_, ec);
+        }
+        if (!ec)
+        {
+            acceptor_.listen(boost::asio::socket_base::max_listen_connections,
+                             ec);
+        }
+        if (ec)
+        {
+            OTEL_INTERNAL_LOG_ERROR("[Metrics Server] cannot listen on "
+                                    << endpoint_ << ": " << ec.message());
+            return false;
+        }
+        accept();
+        return true;
+    }
+
+    /**
+     * Stop accepting scrapers. Safe to call from any thread.
+     */
+    void stop()
+    {
+        boost::asio::post(acceptor_.get_executor(),
+                          [self = shared_from_this()] {
+            boost::system::error_code ec;
+            self->acceptor_.close(ec);
+        });
+    }
+
+  private:
+    class Session : public std::enable_shared_from_this<Session>
+    {
+      public:
+        Session(tcp::socket socket, std::shared_ptr<MetricsHttpServer> server) :
+            stream_(std::move(socket)), server_(std::move(server))
+        {}
+
+        /**
+         * Wait up to idle_timeout for the next request to start arriving
+         */
+        void read()
+        {
+            request_ = {};
+            if (buffer_.size() != 0)
+            {
+                // A pipelined request is already buffered
+                readRequest();
+                return;
+            }
+            stream_.expires_after(server_->idle_timeout_);
+            stream_.async_read_some(
+                buffer_.prepare(kReadSize),
+                [self = shared_from_this()](boost::system::error_code ec,
+                                            std::size_t size) {
+                if (ec)
+                {
+                    self->close();
+                    return;
+                }
+                self->buffer_.commit(size);
+                self->readRequest();
+            });
+        }
+
+      private:
+        static constexpr std::size_t kReadSize = 1024;
+
+        void readRequest()
+        {
+            stream_.expires_after(server_->read_timeout_);
+            boost::beast::http::async_read(
+                stream_, buffer_, request_,
+                [self = shared_from_this()](boost::system::error_code ec,
+                                            std::size_t) {
+                if (ec)
+                {
+                    self->close();
+                    return;
+                }
+                self->respond();
+            });
+        }
+
+        void respond()
+        {
+            namespace http = boost::beast::http;
+            response_ = {};
+            response_.version(request_.version());
+            response_.keep_alive(request_.keep_alive());
+            response_.set(http::field::server, "bmctelemetry");
+
+            // Keep the payload alive until it has been written out
+            payload_.reset();
+            // Scrapers may add a query string, e.g. /metrics?name[]=x
+            std::string_view path(request_.target().data(),
+                                  request_.target().size());
+            path = path.substr(0, path.find('?'));
+            if (request_.method() != http::verb::get &&
+                request_.method() != http::verb::head)
+            {
+                response_.result(http::status::method_not_allowed);
+            }
+            else if (path != server_->path_)
+            {
+                response_.result(http::status::not_found);
+            }
+            else
+            {
+                payload_ = server_->snapshot_->load();
+                response_.result(http::status::ok);
+                response_.set(http::field::content_type,
+                              "text/plain; version=0.0.4; charset=utf-8");
+                if (request_.method() == http::verb::get)
+                {
+                    response_.body() = http::span_body<const char>::value_type(
+                        payload_->data(), payload_->size());
+                }
+            }
+            response_.content_length(payload_ ? payload_->size() : 0);
+
+            stream_.expires_after(server_->read_timeout_);
+            http::async_write(
+                stream_, response_,
+                [self = shared_from_this()](boost::system::error_code ec,
+                                            std::size_t) {
+                if (ec || !self->response_.keep_alive())
+                {
+                    self->close();
+                    return;
+                }
+                self->read();
+            });
+        }
+
+        void close()
+        {
+            boost::system::error_code ec;
+            stream_.socket().shutdown(tcp::socket::shutdown_both, ec);
+            stream_.close();
+        }
+
+        boost::beast::tcp_stream stream_;
+        std::shared_ptr<MetricsHttpServer> server_;
+        boost::beast::flat_buffer buffer_;
+        boost::beast::http::request<boost::beast::http::empty_body> request_;
+        boost::beast::http::response<boost::beast::http::span_body<const char>>
+            response_;
+        MetricsSnapshot::Payload payload_;
+    };
+
+    void accept()
+    {
+        acceptor_.async_accept([self = shared_from_this()](
+                                   boost::system::error_code ec,
+                                   tcp::socket socket) {
+            if (ec == boost::asio::error::operation_aborted)
+            {
+                return;
+            }
+            if (!ec)
+            {
+                std::make_shared<Session>(std::move(socket), self)->read();
+            }
+            self->accept();
+        });
+    }
+
+    tcp::acceptor acceptor_;
+    tcp::endpoint endpoint_;
+    std::string path_;
+    std::shared_ptr<MetricsSnapshot> snapshot_;
+    std::chrono::seconds idle_timeout_;
+    std::chrono::seconds read_timeout_;
+};
+
+} // namespace bmctelemetry
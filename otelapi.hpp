@@ -2,10 +2,11 @@
 #include "opentelemetry/exporters/ostream/metric_exporter_factory.h"
 #include "opentelemetry/exporters/ostream/span_exporter_factory.h"
 #include "opentelemetry/logs/provider.h"
+#include "opentelemetry/metrics/noop.h"
 #include "opentelemetry/metrics/provider.h"
 #include "opentelemetry/sdk/logs/logger_provider_factory.h"
 #include "opentelemetry/sdk/logs/processor.h"
-#include "opentelemetry/sdk/logs/simple_log_record_processor_factory.h"
+#include "opentelemetry/sdk/metrics/aggregation/aggregation_config.h"
 #include "opentelemetry/sdk/metrics/aggregation/default_aggregation.h"
 #include "opentelemetry/sdk/metrics/aggregation/histogram_aggregation.h"
 #include "opentelemetry/sdk/metrics/export/periodic_exporting_metric_reader_factory.h"
@@ -16,15 +17,33 @@
 #include "opentelemetry/sdk/metrics/view/instrument_selector_factory.h"
 #include "opentelemetry/sdk/metrics/view/meter_selector_factory.h"
 #include "opentelemetry/sdk/metrics/view/view_factory.h"
+#include "opentelemetry/sdk/resource/resource.h"
 #include "opentelemetry/sdk/trace/exporter.h"
 #include "opentelemetry/sdk/trace/processor.h"
-#include "opentelemetry/sdk/trace/simple_processor_factory.h"
 #include "opentelemetry/sdk/trace/tracer_provider_factory.h"
 #include "opentelemetry/sdk/version/version.h"
 #include "opentelemetry/trace/provider.h"
 
+#include "attributefilter.hpp"
+#include "batchlogprocessor.hpp"
+#include "batchspanprocessor.hpp"
+#include "cardinalitylimit.hpp"
+#include "exporttelemetry.hpp"
+#include "instrumentregistry.hpp"
+#include "metricsserver.hpp"
 #include "otelmetricexporter.hpp"
 #include "prometheusexporter.hpp"
+#include "prometheuspullexporter.hpp"
+#include "shardedcounter.hpp"
+#include "spanmetricsprocessor.hpp"
+#include "tailsamplingprocessor.hpp"
+#include "tracesampler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
 namespace bmctelemetry
 {
 namespace trace = opentelemetry::trace;
@@ -39,21 +58,95 @@ namespace metrics_sdk = opentelemetry::sdk::metrics;
 namespace common = opentelemetry::common;
 namespace exportermetrics = opentelemetry::exporter::metrics;
 namespace metrics_api = opentelemetry::metrics;
-inline nostd::shared_ptr<trace::Tracer> get_tracer()
+// Bumped by setTracerProvider so cached tracers know to refresh
+inline std::atomic<std::uint64_t> tracerGeneration{1};
+inline std::atomic<bool> tracingSwitch{true};
+
+/**
+ * Install `provider` as the global tracer provider. Tracers cached by
+ * get_tracer() only notice providers installed through this function.
+ */
+inline void setTracerProvider(
+    const std::shared_ptr<trace_api::TracerProvider>& provider)
+{
+    trace_api::Provider::SetTracerProvider(provider);
+    tracerGeneration.fetch_add(1, std::memory_order_acq_rel);
+}
+
+/**
+ * Tracer of the current global provider. Each thread keeps its own copy
+ * and only goes back to the provider after setTracerProvider.
+ */
+inline const nostd::shared_ptr<trace::Tracer>& get_tracer()
+{
+    struct CachedTracer
+    {
+        std::uint64_t generation = 0;
+        nostd::shared_ptr<trace::Tracer> tracer;
+    };
+    thread_local CachedTracer cached;
+    auto generation = tracerGeneration.load(std::memory_order_acquire);
+    if (cached.generation != generation) [[unlikely]]
+    {
+        auto provider = trace::Provider::GetTracerProvider();
+        cached.tracer = provider->GetTracer(libraryname,
+                                            OPENTELEMETRY_SDK_VERSION);
+        cached.generation = generation;
+    }
+    return cached.tracer;
+}
+
+/**
+ * Switch span creation by TRACE_FUNCION and START_TRACE on or off at runtime
+ */
+inline void setTracingEnabled(bool enabled)
+{
+    tracingSwitch.store(enabled, std::memory_order_relaxed);
+}
+inline bool tracingEnabled()
 {
-    auto provider = trace::Provider::GetTracerProvider();
-    return provider->GetTracer(libraryname, OPENTELEMETRY_SDK_VERSION);
+    return tracingSwitch.load(std::memory_order_relaxed);
 }
+
+/**
+ * Span that is active for the lifetime of this object. Costs a single
+ * branch when tracing is switched off.
+ */
+class TraceScope
+{
+  public:
+    explicit TraceScope(nostd::string_view name)
+    {
+        if (tracingEnabled()) [[likely]]
+        {
+            scope_.emplace(get_tracer()->StartSpan(name));
+        }
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+  private:
+    std::optional<trace::Scope> scope_;
+};
+/**
+ * Struct to hold OtelLogger options.
+ */
+struct OtelLoggerOptions
+{
+    BatchProcessorOptions batch;
+};
 struct OtelLogger
 {
-    OtelLogger()
+    explicit OtelLogger(const OtelLoggerOptions& options = {})
     {
         auto exporter = std::unique_ptr<logs_sdk::LogRecordExporter>(
             new logs_exporter::OStreamLogRecordExporter);
-        auto processor = logs_sdk::SimpleLogRecordProcessorFactory::Create(
-            std::move(exporter));
+        auto batchProcessor =
+            std::make_unique<LockFreeBatchLogRecordProcessor>(
+                std::move(exporter), options.batch);
+        processor = batchProcessor.get();
         std::shared_ptr<logs_api::LoggerProvider> provider(
-            logs_sdk::LoggerProviderFactory::Create(std::move(processor)));
+            logs_sdk::LoggerProviderFactory::Create(std::move(batchProcessor)));
 
         // Set the global logger provider
         logs_api::Provider::SetLoggerProvider(provider);
@@ -63,36 +156,96 @@ struct OtelLogger
         std::shared_ptr<logs_api::LoggerProvider> none;
         logs_api::Provider::SetLoggerProvider(none);
     }
-    static OtelLogger& globalInstance()
+    /**
+     * Log records queued, exported and dropped by the batch processor
+     */
+    BatchStats logStats() const
     {
-        static OtelLogger instance;
+        return processor->stats();
+    }
+    // options only take effect on the first call
+    static OtelLogger& globalInstance(const OtelLoggerOptions& options = {})
+    {
+        static OtelLogger instance(options);
         return instance;
     }
+
+  private:
+    // Owned by the logger provider
+    LockFreeBatchLogRecordProcessor* processor{nullptr};
+};
+/**
+ * Struct to hold OtelTracer options.
+ */
+struct OtelTracerOptions
+{
+    BatchProcessorOptions batch;
+    SamplerOptions sampler;
+    // Keep only slow or failed traces when set
+    std::optional<TailSamplingOptions> tail_sampling;
+    // Derive call, error and duration metrics from spans when set
+    std::optional<SpanMetricsOptions> span_metrics;
+    // Send spans to the span exporter; may be turned off with span_metrics
+    bool export_spans = true;
 };
 struct OtelTracer
 {
-    OtelTracer()
+    explicit OtelTracer(const OtelTracerOptions& options = {})
     {
-        // Create ostream span exporter instance
-        auto exporter = trace_exporter::OStreamSpanExporterFactory::Create();
-        auto processor =
-            trace_sdk::SimpleSpanProcessorFactory::Create(std::move(exporter));
+        std::vector<std::unique_ptr<trace_sdk::SpanProcessor>> processors;
+        if (options.export_spans)
+        {
+            // Create ostream span exporter instance
+            auto exporter =
+                trace_exporter::OStreamSpanExporterFactory::Create();
+            auto batchProcessor = std::make_unique<LockFreeBatchSpanProcessor>(
+                std::move(exporter), options.batch);
+            processor = batchProcessor.get();
+            std::unique_ptr<trace_sdk::SpanProcessor> spanProcessor =
+                std::move(batchProcessor);
+            if (options.tail_sampling)
+            {
+                spanProcessor = std::make_unique<TailSamplingSpanProcessor>(
+                    std::move(spanProcessor), *options.tail_sampling);
+            }
+            processors.push_back(std::move(spanProcessor));
+        }
+        if (options.span_metrics)
+        {
+            processors.push_back(
+                std::make_unique<SpanMetricsProcessor>(*options.span_metrics));
+        }
         std::shared_ptr<trace_api::TracerProvider> provider =
-            trace_sdk::TracerProviderFactory::Create(std::move(processor));
+            trace_sdk::TracerProviderFactory::Create(
+                std::move(processors),
+                opentelemetry::sdk::resource::Resource::Create({}),
+                makeSampler(options.sampler));
 
         // Set the global trace provider
-        trace_api::Provider::SetTracerProvider(provider);
+        setTracerProvider(provider);
     }
     ~OtelTracer()
     {
         std::shared_ptr<trace_api::TracerProvider> none;
-        trace_api::Provider::SetTracerProvider(none);
+        setTracerProvider(none);
     }
-    static OtelTracer& globalInstance()
+    /**
+     * Spans queued, exported and dropped by the batch processor
+     */
+    BatchStats spanStats() const
     {
-        static OtelTracer instance;
+        return processor ? processor->stats() : BatchStats{};
+    }
+    // options only take effect on the first call
+    static OtelTracer& globalInstance(const OtelTracerOptions& options = {})
+    {
+        static OtelTracer instance(options);
         return instance;
     }
+
+  private:
+    // Owned by the tracer provider
+    LockFreeBatchSpanProcessor* processor{nullptr};
 };
 
 struct OtelMetrics
@@ -101,6 +254,9 @@ struct OtelMetrics
     {
         std::string url_;
         net::io_context* context{nullptr};
+        PrometheusMetricExporterOptions exporterOptions;
+        std::optional<PullEndpoint> pullEndpoint;
+        std::chrono::milliseconds exportInterval{5000};
         OtelMetricsBuilder& withContext(net::io_context& c)
         {
             context = &c;
@@ -111,10 +267,47 @@ struct OtelMetrics
             url_ = url;
             return *this;
         }
+        OtelMetricsBuilder& withStreamingWriter(bool enable)
+        {
+            exporterOptions.streaming_writer = enable;
+            return *this;
+        }
+        OtelMetricsBuilder& withPushTimeout(std::chrono::milliseconds timeout)
+        {
+            exporterOptions.push_timeout = timeout;
+            return *this;
+        }
+        OtelMetricsBuilder& withCompression(int level, std::size_t minSize)
+        {
+            exporterOptions.compression = true;
+            exporterOptions.compression_level = level;
+            exporterOptions.compression_min_size = minSize;
+            return *this;
+        }
+        OtelMetricsBuilder& withChangeOnlyPushes(std::uint32_t fullRefreshEvery)
+        {
+            exporterOptions.change_only_refresh_cycles = fullRefreshEvery;
+            return *this;
+        }
+        // Serve /metrics from the io_context instead of pushing to url_
+        OtelMetricsBuilder& withPullEndpoint(const PullEndpoint& endpoint)
+        {
+            pullEndpoint = endpoint;
+            return *this;
+        }
+        // How often the periodic reader collects and exports
+        OtelMetricsBuilder&
+            withExportInterval(std::chrono::milliseconds interval)
+        {
+            exportInterval = interval;
+            return *this;
+        }
 
         OtelMetrics& getMetrics()
         {
-            static OtelMetrics metrics(url_, context->get_executor());
+            static OtelMetrics metrics(url_, context->get_executor(),
+                                       exporterOptions, pullEndpoint,
+                                       exportInterval);
             return metrics;
         }
         static OtelMetricsBuilder& globalInstance()
@@ -125,14 +318,42 @@ struct OtelMetrics
     };
 
     metrics_sdk::MeterProvider* p{nullptr};
-    OtelMetrics(const std::string& uri, net::io_context::executor_type ex)
+    // Also held by bound histograms, which may outlive this object
+    std::shared_ptr<opentelemetry::metrics::MeterProvider> provider;
+    std::shared_ptr<MetricsHttpServer> server;
+    InstrumentRegistry instruments;
+    AttributeInterner attributeSets;
+    std::shared_ptr<ExportTelemetry> exportTelemetry =
+        std::make_shared<ExportTelemetry>();
+    std::unique_ptr<ExportTelemetryMetrics> exportTelemetryMetrics;
+    OtelMetrics(const std::string& uri, net::io_context::executor_type ex,
+                const PrometheusMetricExporterOptions& exporterOptions = {},
+                const std::optional<PullEndpoint>& pullEndpoint = std::nullopt,
+                std::chrono::milliseconds exportInterval =
+                    std::chrono::milliseconds(5000))
     {
-        auto exporter = std::make_unique<PrometheusMetricExporter>(uri, ex);
+        std::unique_ptr<metrics_sdk::PushMetricExporter> exporter;
+        if (pullEndpoint)
+        {
+            auto snapshot = std::make_shared<MetricsSnapshot>();
+            exporter = std::make_unique<PrometheusPullExporter>(
+                snapshot, metrics_sdk::AggregationTemporality::kCumulative,
+                exportTelemetry);
+            startServer(ex, *pullEndpoint, std::move(snapshot));
+        }
+        else
+        {
+            exporter = std::make_unique<PrometheusMetricExporter>(
+                uri, ex, exporterOptions,
+                metrics_sdk::AggregationTemporality::kCumulative,
+                exportTelemetry);
+        }
 
         // Initialize and set the global MeterProvider
         metrics_sdk::PeriodicExportingMetricReaderOptions options;
-        options.export_interval_millis = std::chrono::milliseconds(5000);
-        options.export_timeout_millis = std::chrono::milliseconds(500);
+        options.export_interval_millis = exportInterval;
+        options.export_timeout_millis =
+            std::min(exportInterval, std::chrono::milliseconds(500));
 
         auto reader = metrics_sdk::PeriodicExportingMetricReaderFactory::Create(
             std::move(exporter), options);
@@ -142,12 +363,73 @@ struct OtelMetrics
 
         p->AddMetricReader(std::move(reader));
 
-        std::shared_ptr<opentelemetry::metrics::MeterProvider> provider(
-            std::move(u_provider));
+        provider = std::move(u_provider);
         metrics_api::Provider::SetMeterProvider(provider);
+
+        // Cost of the export pipeline, under the reserved otel_exporter_
+        // prefix
+        exportTelemetryMetrics = std::make_unique<ExportTelemetryMetrics>(
+            meter("otel_exporter"), exportTelemetry);
+    }
+    void startServer(net::io_context::executor_type ex,
+                     const PullEndpoint& endpoint,
+                     std::shared_ptr<MetricsSnapshot> snapshot)
+    {
+        boost::system::error_code ec;
+        auto address = net::ip::make_address(endpoint.address, ec);
+        if (ec)
+        {
+            OTEL_INTERNAL_LOG_ERROR("[OtelMetrics] invalid pull address "
+                                    << endpoint.address);
+            return;
+        }
+        server = std::make_shared<MetricsHttpServer>(
+            ex, net::ip::tcp::endpoint(address, endpoint.port), endpoint.path,
+            std::move(snapshot), endpoint.idle_timeout, endpoint.read_timeout);
+        if (!server->start())
+        {
+            server.reset();
+        }
+    }
+    nostd::shared_ptr<metrics_api::Meter> meter(const std::string& name)
+    {
+        return p->GetMeter(name, "1.2.0");
     }
+    std::shared_ptr<metrics_api::Histogram<double>>
+        histogram(const std::string& name, const std::string& description,
+                  const std::string& unit)
+    {
+        const auto& handle = instruments.getOrCreate(
+            {name, name, unit, InstrumentKind::DoubleHistogram}, [&] {
+            return InstrumentRegistry::Handle(
+                std::shared_ptr<metrics_api::Histogram<double>>(
+                    meter(name)
+                        ->CreateDoubleHistogram(name, description, unit)
+                        .release()));
+        });
+        return std::get<std::shared_ptr<metrics_api::Histogram<double>>>(
+            handle);
+    }
+    static std::unique_ptr<metrics_sdk::AttributesProcessor>
+        attributesProcessor(const AttributeFilter& filter)
+    {
+        if (filter.keepsAll())
+        {
+            return std::make_unique<metrics_sdk::DefaultAttributesProcessor>();
+        }
+        return std::make_unique<FilteringAttributesProcessor>(filter);
+    }
+    /**
+     * A non zero `cardinalityLimit` on the add*View calls caps the distinct
+     * attribute sets of the view; the rest fold into one
+     * otel.metric.overflow=true series (see limitCardinality for the SDKs
+     * that support it). `filter` drops attribute keys before aggregation,
+     * and the limit counts the filtered sets.
+     */
     void addCounterView(const std::string& name, const std::string& version,
-                        const std::string& schema)
+                        const std::string& schema,
+                        std::size_t cardinalityLimit = 0,
+                        const AttributeFilter& filter = {})
     {
         std::string counter_name = name + "_counter";
         std::string unit = "counter-unit";
@@ -160,14 +442,19 @@ struct OtelMetrics
             metrics_sdk::MeterSelectorFactory::Create(name, version, schema);
 
         auto sum_view = metrics_sdk::ViewFactory::Create(
-            name, "description", unit, metrics_sdk::AggregationType::kSum);
+            name, "description", unit, metrics_sdk::AggregationType::kSum,
+            limitCardinality<metrics_sdk::AggregationConfig>(nullptr,
+                                                             cardinalityLimit),
+            attributesProcessor(filter));
 
         p->AddView(std::move(instrument_selector), std::move(meter_selector),
                    std::move(sum_view));
     }
     void addObservableCounterView(const std::string& name,
                                   const std::string& version,
-                                  const std::string& schema)
+                                  const std::string& schema,
+                                  std::size_t cardinalityLimit = 0,
+                                  const AttributeFilter& filter = {})
     {
         std::string unit = "observable-counter-unit";
         // observable counter view
@@ -182,14 +469,19 @@ struct OtelMetrics
             metrics_sdk::MeterSelectorFactory::Create(name, version, schema);
 
         auto observable_sum_view = metrics_sdk::ViewFactory::Create(
-            name, "test_description", unit, metrics_sdk::AggregationType::kSum);
+            name, "test_description", unit, metrics_sdk::AggregationType::kSum,
+            limitCardinality<metrics_sdk::AggregationConfig>(nullptr,
+                                                             cardinalityLimit),
+            attributesProcessor(filter));
 
         p->AddView(std::move(observable_instrument_selector),
                    std::move(observable_meter_selector),
                    std::move(observable_sum_view));
     }
     void addHistogramView(const std::string& name, const std::string& version,
-                          const std::string& schema)
+                          const std::string& schema,
+                          std::size_t cardinalityLimit = 0,
+                          const AttributeFilter& filter = {})
     {
         std::string unit = "histogram-unit";
         std::string histogram_name = name + "_histogram";
@@ -213,34 +505,184 @@ struct OtelMetrics
 
         auto histogram_view = metrics_sdk::ViewFactory::Create(
             name, "description", unit, metrics_sdk::AggregationType::kHistogram,
-            aggregation_config);
+            limitCardinality(std::move(aggregation_config), cardinalityLimit),
+            attributesProcessor(filter));
 
         p->AddView(std::move(histogram_instrument_selector),
                    std::move(histogram_meter_selector),
                    std::move(histogram_view));
     }
-    auto createDoubleCounter(const std::string& name)
+    /**
+     * Histogram view with base-2 exponential buckets: resolution adapts to
+     * the recorded range, bounded by `maxScale` and `maxBuckets` per series.
+     * The Prometheus exporters write them as classic buckets at a fixed
+     * scale, the lower of `maxScale` and `exportScale`, so the `le` bounds
+     * stay put across scrapes and rate() works on them.
+     */
+    void addExponentialHistogramView(
+        const std::string& name, const std::string& version,
+        const std::string& schema, std::int32_t maxScale = 20,
+        std::size_t maxBuckets = 160, std::size_t cardinalityLimit = 0,
+        const AttributeFilter& filter = {},
+        std::int32_t exportScale =
+            PrometheusExporterUtils::kExponentialBucketScale)
     {
-        nostd::shared_ptr<metrics_api::Meter> meter = p->GetMeter(name,
-                                                                  "1.2.0");
-        return meter->CreateDoubleCounter(name);
+        std::string unit = "histogram-unit";
+        std::string histogram_name = name + "_histogram";
+        auto histogram_instrument_selector =
+            metrics_sdk::InstrumentSelectorFactory::Create(
+                metrics_sdk::InstrumentType::kHistogram, histogram_name, unit);
+
+        auto histogram_meter_selector =
+            metrics_sdk::MeterSelectorFactory::Create(name, version, schema);
+
+        auto histogram_aggregation_config = std::make_shared<
+            metrics_sdk::Base2ExponentialHistogramAggregationConfig>();
+        histogram_aggregation_config->max_scale_ = maxScale;
+        histogram_aggregation_config->max_buckets_ = maxBuckets;
+
+        auto histogram_view = metrics_sdk::ViewFactory::Create(
+            name, "description", unit,
+            metrics_sdk::AggregationType::kBase2ExponentialHistogram,
+            limitCardinality(std::move(histogram_aggregation_config),
+                             cardinalityLimit),
+            attributesProcessor(filter));
+        PrometheusExporterUtils::SetExponentialExportScale(
+            name, std::min(maxScale, exportScale));
+
+        p->AddView(std::move(histogram_instrument_selector),
+                   std::move(histogram_meter_selector),
+                   std::move(histogram_view));
+    }
+    /**
+     * Instruments are created once per name and unit; later calls return the
+     * cached handle, which stays valid as long as this object
+     */
+    metrics_api::Counter<double>* createDoubleCounter(const std::string& name)
+    {
+        const auto& handle = instruments.getOrCreate(
+            {name, name, {}, InstrumentKind::DoubleCounter}, [&] {
+            return InstrumentRegistry::Handle(
+                meter(name)->CreateDoubleCounter(name));
+        });
+        if (std::holds_alternative<std::monostate>(handle))
+        {
+            // The name is taken by bindCounter
+            static metrics_api::NoopCounter<double> discarding(name, "", "");
+            return &discarding;
+        }
+        return std::get<nostd::unique_ptr<metrics_api::Counter<double>>>(handle)
+            .get();
+    }
+    nostd::shared_ptr<metrics_api::ObservableInstrument>
+        createDoubleObservableCounter(const std::string& name)
+    {
+        const auto& handle = instruments.getOrCreate(
+            {name, name, {}, InstrumentKind::DoubleObservableCounter}, [&] {
+            return InstrumentRegistry::Handle(
+                meter(name)->CreateDoubleObservableCounter(name));
+        });
+        return std::get<nostd::shared_ptr<metrics_api::ObservableInstrument>>(
+            handle);
+    }
+    /**
+     * Counter for hot multi-threaded paths: Add only touches a per thread
+     * slot and the slots are summed when the metric reader collects
+     */
+    std::shared_ptr<ShardedCounter>
+        createShardedCounter(const std::string& name,
+                             const std::string& description = "",
+                             const std::string& unit = "")
+    {
+        const auto& handle = instruments.getOrCreate(
+            {name, name, unit, InstrumentKind::ShardedCounter}, [&] {
+            return InstrumentRegistry::Handle(std::make_shared<ShardedCounter>(
+                meter(name)->CreateDoubleObservableCounter(name, description,
+                                                           unit)));
+        });
+        return std::get<std::shared_ptr<ShardedCounter>>(handle);
     }
-    auto createDoubleObservableCounter(const std::string& name)
+    metrics_api::Histogram<double>*
+        createDoubleHistogram(const std::string& name,
+                              const std::string& description,
+                              const std::string& unit)
     {
-        nostd::shared_ptr<metrics_api::Meter> meter = p->GetMeter(name,
-                                                                  "1.2.0");
-        return meter->CreateDoubleObservableCounter(name);
+        return histogram(name, description, unit).get();
     }
-    auto createDoubleHistogram(const std::string& name,
-                               const std::string& description,
-                               const std::string& unit)
+    /**
+     * Instrument exported as a Prometheus Summary with the given quantiles,
+     * estimated by a DDSketch within `relativeAccuracy` over the last
+     * `maxAge`, in `ageBuckets` steps. A zero maxAge keeps lifetime
+     * quantiles.
+     */
+    std::shared_ptr<QuantileInstrument> createQuantile(
+        const std::string& name, const std::string& description,
+        const std::string& unit,
+        std::vector<double> quantiles = {0.5, 0.9, 0.99, 0.999},
+        double relativeAccuracy = 0.01,
+        std::chrono::seconds maxAge = std::chrono::seconds(60),
+        std::size_t ageBuckets = 5)
     {
-        nostd::shared_ptr<metrics_api::Meter> meter = p->GetMeter(name,
-                                                                  "1.2.0");
-        return meter->CreateDoubleHistogram(name, description, unit);
+        const auto& handle = instruments.getOrCreate(
+            {name, name, unit, InstrumentKind::Quantile}, [&] {
+            auto instrument = std::make_shared<QuantileInstrument>(
+                name, description, unit, std::move(quantiles),
+                relativeAccuracy, 2048, maxAge, ageBuckets);
+            QuantileRegistry::globalInstance().add(instrument);
+            return InstrumentRegistry::Handle(std::move(instrument));
+        });
+        return std::get<std::shared_ptr<QuantileInstrument>>(handle);
+    }
+    /**
+     * Intern an attribute set once for use with the bind* calls
+     */
+    std::shared_ptr<const AttributeSet> attributes(
+        std::initializer_list<std::pair<std::string_view, std::string_view>>
+            keyValues)
+    {
+        return attributeSets.intern(keyValues);
+    }
+    /**
+     * Counter handle whose Add goes straight to the cell of `attributes`.
+     * A name already used by another instrument cannot be bound; its handle
+     * discards every Add.
+     */
+    BoundCounter bindCounter(const std::string& name,
+                             const std::shared_ptr<const AttributeSet>& set)
+    {
+        const auto& handle = instruments.getOrCreate(
+            {name, name, {}, InstrumentKind::BoundCounter}, [&] {
+            return InstrumentRegistry::Handle(
+                std::make_shared<BoundCounterFamily>(
+                    meter(name)->CreateDoubleObservableCounter(name)));
+        });
+        if (std::holds_alternative<std::monostate>(handle))
+        {
+            return BoundCounter::discarding();
+        }
+        return std::get<std::shared_ptr<BoundCounterFamily>>(handle)->bind(set);
+    }
+    /**
+     * Histogram handle that records with the prebuilt `attributes`. It keeps
+     * the instrument and its provider alive, so it may outlive this object.
+     */
+    BoundHistogram bindHistogram(const std::string& name,
+                                 const std::string& description,
+                                 const std::string& unit,
+                                 std::shared_ptr<const AttributeSet> set)
+    {
+        return BoundHistogram(provider, histogram(name, description, unit),
+                              std::move(set));
     }
     ~OtelMetrics()
     {
+        exportTelemetryMetrics.reset();
+        // Instruments must not outlive the provider that created them
+        instruments.clear();
+        if (server)
+        {
+            server->stop();
+        }
         std::shared_ptr<opentelemetry::metrics::MeterProvider> none;
         metrics_api::Provider::SetMeterProvider(none);
         p = nullptr;
@@ -248,9 +690,10 @@ struct OtelMetrics
 };
 } // namespace bmctelemetry
 
-#define TRACE_FUNCION                                                          \
-    auto func_span = bmctelemetry::trace::Scope(                               \
-        bmctelemetry::get_tracer()->StartSpan(__FUNCTION__));
-#define START_TRACE(X)                                                         \
-    auto X =                                                                   \
-        bmctelemetry::trace::Scope(bmctelemetry::get_tracer()->StartSpan(#X));
+#ifdef BMCTELEMETRY_DISABLE_TRACING
+#define TRACE_FUNCION
+#define START_TRACE(X)
+#else
+#define TRACE_FUNCION bmctelemetry::TraceScope func_span(__FUNCTION__);
+#define START_TRACE(X) bmctelemetry::TraceScope X(#X);
+#endif
@@ -11,11 +11,17 @@
 #include "opentelemetry/sdk/resource/resource.h"
 #include "opentelemetry/version.h"
 
-#include "client/http/http_subscriber.hpp"
 #include "common_utils.hpp"
+#include "exporttelemetry.hpp"
+#include "pushpipeline.hpp"
+#include "quantilesketch.hpp"
 
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
 
 using namespace reactor;
 using namespace opentelemetry;
@@ -213,6 +219,30 @@ inline void
     }
 }
 
+inline void printMetricData(
+    std::ostream& sout_, const opentelemetry::sdk::metrics::MetricData& record,
+    const opentelemetry::sdk::metrics::ResourceMetrics& data)
+{
+    sout_ << "\n  start time\t: " << timeToString(record.start_ts)
+          << "\n  end time\t: " << timeToString(record.end_ts)
+          << "\n  instrument name\t: " << record.instrument_descriptor.name_
+          << "\n  description\t: " << record.instrument_descriptor.description_
+          << "\n  unit\t\t: " << record.instrument_descriptor.unit_;
+
+    for (const auto& pd : record.point_data_attr_)
+    {
+        if (!opentelemetry::nostd::holds_alternative<
+                opentelemetry::sdk::metrics::DropPointData>(pd.point_data))
+        {
+            printPointData(sout_, pd.point_data);
+            printPointAttributes(sout_, pd.attributes);
+        }
+    }
+
+    sout_ << "\n  resources\t:";
+    printResources(sout_, *data.resource_);
+}
+
 inline void printInstrumentationInfoMetricData(
     std::ostream& sout_,
     const opentelemetry::sdk::metrics::ScopeMetrics& info_metric,
@@ -225,61 +255,65 @@ inline void printInstrumentationInfoMetricData(
           << "\n  version\t: " << info_metric.scope_->GetVersion();
     for (const auto& record : info_metric.metric_data_)
     {
-        sout_ << "\n  start time\t: " << timeToString(record.start_ts)
-              << "\n  end time\t: " << timeToString(record.end_ts)
-              << "\n  instrument name\t: " << record.instrument_descriptor.name_
-              << "\n  description\t: "
-              << record.instrument_descriptor.description_
-              << "\n  unit\t\t: " << record.instrument_descriptor.unit_;
+        printMetricData(sout_, record, data);
+    }
+    sout_ << "\n}\n";
+}
 
-        for (const auto& pd : record.point_data_attr_)
+/**
+ * Print the quantile instruments, which the SDK does not collect, in the
+ * same format as the SDK's metrics
+ */
+inline void printSummaries(std::ostream& sout_,
+                           const std::vector<QuantileSnapshot>& summaries)
+{
+    if (summaries.empty())
+    {
+        return;
+    }
+    sout_ << "{";
+    for (const auto& summary : summaries)
+    {
+        sout_ << "\n  instrument name\t: " << summary.name
+              << "\n  description\t: " << summary.description
+              << "\n  unit\t\t: " << summary.unit
+              << "\n  type\t\t: SummaryPointData"
+              << "\n  count\t\t: " << summary.count
+              << "\n  sum\t\t: " << summary.sum << "\n  quantiles\t: [";
+        for (const auto& [quantile, value] : summary.quantiles)
         {
-            if (!opentelemetry::nostd::holds_alternative<
-                    opentelemetry::sdk::metrics::DropPointData>(pd.point_data))
-            {
-                printPointData(sout_, pd.point_data);
-                printPointAttributes(sout_, pd.attributes);
-            }
+            sout_ << "\n\t" << quantile << ": " << value;
         }
-
-        sout_ << "\n  resources\t:";
-        printResources(sout_, *data.resource_);
+        sout_ << "]";
     }
     sout_ << "\n}\n";
 }
 
 /**
- * The OtelMetricExporter exports record data through an ostream
+ * The OtelMetricExporter prints record data in the ostream exporter format
+ * and pushes it to `url` through a PushPipeline
  */
 class OtelMetricExporter final :
     public opentelemetry::sdk::metrics::PushMetricExporter
 {
   public:
     /**
-     * Create an OtelMetricExporter. This constructor takes in a reference to an
-     * ostream that the export() function will send metrics data into. The
-     * default ostream is set to stdout
+     * Create an OtelMetricExporter pushing to `url` on the io_context of
+     * `ex`. A push still in flight after `push_timeout` counts as failed.
      */
-
     explicit OtelMetricExporter(
         const std::string& url, net::io_context::executor_type ex,
         opentelemetry::sdk::metrics::AggregationTemporality
             aggregation_temporality = opentelemetry::sdk::metrics::
-                AggregationTemporality::kCumulative) noexcept :
-        subscriber(ex, url),
+                AggregationTemporality::kCumulative,
+        std::shared_ptr<ExportTelemetry> telemetry = nullptr,
+        std::chrono::milliseconds push_timeout =
+            std::chrono::milliseconds(5000)) noexcept :
+        telemetry_(std::move(telemetry)),
+        pipeline_(std::make_shared<PushPipeline>(url, ex, push_timeout,
+                                                 telemetry_)),
         aggregation_temporality_(aggregation_temporality)
-    {
-        ssl::context ctx{ssl::context::tlsv12_client};
-        ctx.set_verify_mode(ssl::verify_none);
-        subscriber.withSslContext(std::move(ctx));
-        subscriber.withPoolSize(1);
-        subscriber.withPolicy({.maxRetries = 1});
-        subscriber.withSuccessHandler([](const HttpSubscriber::Request&,
-                                         const HttpSubscriber::Response&) {
-            // Handle the response
-            std::cout << "Success: " << std::endl;
-        });
-    }
+    {}
 
     /**
      * Export
@@ -289,17 +323,21 @@ class OtelMetricExporter final :
         Export(const opentelemetry::sdk::metrics::ResourceMetrics&
                    data) noexcept override
     {
-        if (isShutdown())
-        {
-            return opentelemetry::sdk::common::ExportResult::kFailure;
-        }
-        std::stringstream sout_;
-        for (auto& record : data.scope_metric_data_)
+        auto result = doExport(data);
+        if (telemetry_)
         {
-            printInstrumentationInfoMetricData(sout_, record, data);
+            telemetry_->recordExport(
+                result == opentelemetry::sdk::common::ExportResult::kSuccess);
         }
-        subscriber.sendEvent(sout_.str());
-        return opentelemetry::sdk::common::ExportResult::kSuccess;
+        return result;
+    }
+
+    /**
+     * Counters of the push pipeline, as for PrometheusMetricExporter
+     */
+    PushPipeline::Stats pushStats() const
+    {
+        return pipeline_->stats();
     }
 
     /**
@@ -315,12 +353,12 @@ class OtelMetricExporter final :
     }
 
     /**
-     * Force flush the exporter.
+     * Force flush the exporter. Waits for queued and in flight pushes.
      */
     bool ForceFlush(std::chrono::microseconds timeout =
                         (std::chrono::microseconds::max)()) noexcept override
     {
-        return true;
+        return pipeline_->waitIdle(timeout);
     }
 
     /**
@@ -332,19 +370,59 @@ class OtelMetricExporter final :
                       (std::chrono::microseconds::max)()) noexcept override
     {
         is_shutdown_ = true;
-        return true;
+        bool drained = pipeline_->waitIdle(timeout);
+        pipeline_->close();
+        return drained;
     }
 
   private:
-    HttpSubscriber subscriber;
+    static constexpr const char* kContentType = "text/plain; charset=utf-8";
+
+    std::shared_ptr<ExportTelemetry> telemetry_;
+    std::shared_ptr<PushPipeline> pipeline_;
 
-    bool is_shutdown_ = false;
+    std::atomic<bool> is_shutdown_{false};
     opentelemetry::sdk::metrics::AggregationTemporality
         aggregation_temporality_;
     bool isShutdown() const noexcept
     {
         return is_shutdown_;
     }
+
+    opentelemetry::sdk::common::ExportResult
+        doExport(const opentelemetry::sdk::metrics::ResourceMetrics& data)
+    {
+        if (isShutdown())
+        {
+            return opentelemetry::sdk::common::ExportResult::kFailure;
+        }
+        const auto summaries = QuantileRegistry::globalInstance().collect();
+        auto start = ExportTelemetry::Clock::now();
+        std::stringstream sout_;
+        for (auto& record : data.scope_metric_data_)
+        {
+            printInstrumentationInfoMetricData(sout_, record, data);
+        }
+        printSummaries(sout_, summaries);
+        auto payload = sout_.str();
+        if (telemetry_)
+        {
+            telemetry_->recordSerialization(ExportTelemetry::Clock::now() -
+                                            start);
+            telemetry_->recordPayload(
+                payload.size(),
+                ExportTelemetry::countSeries(data) + summaries.size(),
+                ExportTelemetry::countOverflowSeries(data));
+        }
+
+        // The push itself completes asynchronously on the io_context
+        if (!pipeline_->push(
+                PushPayload{std::move(payload), {}, kContentType}))
+        {
+            return opentelemetry::sdk::common::ExportResult::kFailure;
+        }
+        return opentelemetry::sdk::common::ExportResult::kSuccess;
+    }
 };
 
 } // namespace bmctelemetry
@@ -8,10 +8,76 @@
 #include "opentelemetry/version.h"
 #include "prometheus/text_serializer.h"
 
-#include "client/http/http_subscriber.hpp"
+#include "compression.hpp"
 #include "exporter_utils.hpp"
+#include "exporttelemetry.hpp"
+#include "prometheustextwriter.hpp"
+#include "pushpipeline.hpp"
+
+#include <atomic>
+#include <ctime>
+#include <memory>
+#include <mutex>
 namespace bmctelemetry
 {
+    /**
+     * Struct to hold PrometheusMetricExporter options.
+     */
+    struct PrometheusMetricExporterOptions
+    {
+        /**
+         * Serialize with PrometheusTextWriter straight from ResourceMetrics.
+         * When false, fall back to TranslateToPrometheus followed by
+         * prometheus::TextSerializer.
+         */
+        bool streaming_writer = true;
+
+        /**
+         * How long a push may stay in flight before it is counted as failed
+         * and the next payload is sent.
+         */
+        std::chrono::milliseconds push_timeout = std::chrono::milliseconds(5000);
+
+        /**
+         * Check the gateway's TLS certificate against the system store
+         */
+        bool verify_peer = false;
+
+        /**
+         * gzip the pushed body (Content-Encoding: gzip) once it reaches
+         * compression_min_size bytes. Smaller payloads are sent as is.
+         * Needs a reactor that can set headers, see HttpPushClient.
+         */
+        bool compression = false;
+        int compression_level = Z_DEFAULT_COMPRESSION;
+        std::size_t compression_min_size = 64 * 1024;
+
+        /**
+         * When non zero, only push metric families whose series changed
+         * since the previous push, with a full push every
+         * change_only_refresh_cycles exports. Change only payloads are
+         * POSTed, so the gateway keeps the families left out. Full pushes
+         * are PUT, which drops families that no longer exist, when the
+         * reactor can set the method (see HttpPushClient). A push that
+         * is coalesced, dropped or fails makes the next one a full push.
+         * Only supported by the streaming writer.
+         */
+        std::uint32_t change_only_refresh_cycles = 0;
+    };
+
+    /**
+     * Totals reported by PrometheusMetricExporter for compressed pushes
+     */
+    struct CompressionStats
+    {
+        std::uint64_t payloads = 0;
+        std::uint64_t bytes_in = 0;
+        std::uint64_t bytes_out = 0;
+        std::chrono::nanoseconds cpu_time{0};
+        // bytes_out / bytes_in of the most recent compressed payload
+        double last_ratio = 0.0;
+    };
+
     namespace
     {
         std::ostream &operator<<(std::ostream &os,
@@ -95,21 +161,25 @@ namespace bmctelemetry
 
         explicit PrometheusMetricExporter(
             const std::string &url, net::io_context::executor_type ex,
+            const PrometheusMetricExporterOptions &options = {},
             opentelemetry::sdk::metrics::AggregationTemporality
                 aggregation_temporality = opentelemetry::sdk::metrics::
-                    AggregationTemporality::kCumulative) noexcept : subscriber(ex, url),
+                    AggregationTemporality::kCumulative,
+            std::shared_ptr<ExportTelemetry> telemetry = nullptr) noexcept : options_(options),
+                                                                    telemetry_(std::move(telemetry)),
+                                                                    pipeline_(std::make_shared<PushPipeline>(
+                                                                        url, ex, options.push_timeout, telemetry_,
+                                                                        options.verify_peer)),
+                                                                    compressor_(options.compression_level),
                                                                     aggregation_temporality_(aggregation_temporality)
         {
-            ssl::context ctx{ssl::context::tlsv12_client};
-            ctx.set_verify_mode(ssl::verify_none);
-            subscriber.withSslContext(std::move(ctx));
-            subscriber.withPoolSize(1);
-            subscriber.withPolicy({.maxRetries = 1});
-            subscriber.withSuccessHandler([](const HttpSubscriber::Request &,
-                                             const HttpSubscriber::Response &)
-                                          {
-            // Handle the response
-            std::cout << "Success: " << std::endl; });
+            writer_.setChangeOnly(options.change_only_refresh_cycles);
+            if (!HttpPushClient::kSendsHeaders && options_.compression)
+            {
+                OTEL_INTERNAL_LOG_WARN("[Prometheus Exporter] HttpSubscriber cannot set "
+                                       "Content-Encoding, pushing uncompressed");
+                options_.compression = false;
+            }
         }
 
         /**
@@ -120,22 +190,29 @@ namespace bmctelemetry
         Export(const opentelemetry::sdk::metrics::ResourceMetrics &
                    metric_data) noexcept override
         {
-            if (isShutdown())
+            auto result = doExport(metric_data);
+            if (telemetry_)
             {
-                return opentelemetry::sdk::common::ExportResult::kFailure;
+                telemetry_->recordExport(
+                    result == opentelemetry::sdk::common::ExportResult::kSuccess);
             }
-            std::vector<prometheus_client::MetricFamily> result;
-            auto prometheus_metric_data =
-                PrometheusExporterUtils::TranslateToPrometheus(metric_data, false,
-                                                               false);
-            for (auto &data : prometheus_metric_data)
-                result.emplace_back(data);
-
-            const auto serializer = prometheus::TextSerializer{};
+            return result;
+        }
 
-            subscriber.sendEvent(serializer.Serialize(result));
+        /**
+         * Counters of the push pipeline: payloads queued, coalesced
+         * (replaced by a newer payload before being sent), dropped, sent and
+         * failed.
+         */
+        PushPipeline::Stats pushStats() const
+        {
+            return pipeline_->stats();
+        }
 
-            return opentelemetry::sdk::common::ExportResult::kSuccess;
+        CompressionStats compressionStats() const
+        {
+            std::lock_guard<std::mutex> lock(compression_lock_);
+            return compression_stats_;
         }
 
         /**
@@ -151,12 +228,12 @@ namespace bmctelemetry
         }
 
         /**
-         * Force flush the exporter.
+         * Force flush the exporter. Waits for queued and in flight pushes.
          */
         bool ForceFlush(std::chrono::microseconds timeout =
                             (std::chrono::microseconds::max)()) noexcept override
         {
-            return true;
+            return pipeline_->waitIdle(timeout);
         }
 
         /**
@@ -168,19 +245,156 @@ namespace bmctelemetry
                           (std::chrono::microseconds::max)()) noexcept override
         {
             is_shutdown_ = true;
-            return true;
+            bool drained = pipeline_->waitIdle(timeout);
+            pipeline_->close();
+            return drained;
         }
 
     private:
-        HttpSubscriber subscriber;
+        static constexpr const char *kContentType =
+            "text/plain; version=0.0.4; charset=utf-8";
 
-        bool is_shutdown_ = false;
+        PrometheusMetricExporterOptions options_;
+        std::shared_ptr<ExportTelemetry> telemetry_;
+        std::shared_ptr<PushPipeline> pipeline_;
+        std::mutex writer_lock_;
+        PrometheusTextWriter writer_;
+        // Coalesced, dropped and failed pushes seen by the last export
+        std::uint64_t lost_pushes_ = 0;
+
+        mutable std::mutex compression_lock_;
+        GzipCompressor compressor_;
+        CompressionStats compression_stats_;
+
+        std::atomic<bool> is_shutdown_{false};
         opentelemetry::sdk::metrics::AggregationTemporality
             aggregation_temporality_;
         bool isShutdown() const noexcept
         {
             return is_shutdown_;
         }
+
+        opentelemetry::sdk::common::ExportResult
+        doExport(const opentelemetry::sdk::metrics::ResourceMetrics &metric_data)
+        {
+            if (isShutdown())
+            {
+                return opentelemetry::sdk::common::ExportResult::kFailure;
+            }
+            const auto summaries =
+                QuantileRegistry::globalInstance().collect();
+            std::string payload;
+            bool full_refresh = true;
+            auto start = ExportTelemetry::Clock::now();
+            if (options_.streaming_writer)
+            {
+                // Translation and serialization are a single pass here
+                std::lock_guard<std::mutex> lock(writer_lock_);
+                if (options_.change_only_refresh_cycles != 0)
+                {
+                    // Changes carried by a lost push are only resent by a
+                    // full refresh
+                    const auto stats = pipeline_->stats();
+                    const auto lost =
+                        stats.coalesced + stats.dropped + stats.failed;
+                    if (lost != lost_pushes_)
+                    {
+                        lost_pushes_ = lost;
+                        writer_.requestFullRefresh();
+                    }
+                }
+                payload.assign(
+                    writer_.write(metric_data, false, false, summaries));
+                full_refresh = writer_.fullRefresh();
+            }
+            else
+            {
+                const auto prometheus_metric_data =
+                    PrometheusExporterUtils::TranslateToPrometheus(
+                        metric_data, false, false, summaries);
+                auto translated = ExportTelemetry::Clock::now();
+                if (telemetry_)
+                {
+                    telemetry_->recordTranslation(translated - start);
+                }
+                start = translated;
+
+                const auto serializer = prometheus::TextSerializer{};
+                payload = serializer.Serialize(prometheus_metric_data);
+            }
+            if (telemetry_)
+            {
+                telemetry_->recordSerialization(
+                    ExportTelemetry::Clock::now() - start);
+                telemetry_->recordPayload(
+                    payload.size(),
+                    ExportTelemetry::countSeries(metric_data) + summaries.size(),
+                    ExportTelemetry::countOverflowSeries(metric_data));
+            }
+
+            if (payload.empty() && !full_refresh)
+            {
+                // Nothing changed since the last push
+                return opentelemetry::sdk::common::ExportResult::kSuccess;
+            }
+
+            auto push = encode(std::move(payload));
+            if (options_.change_only_refresh_cycles != 0)
+            {
+                push.method = full_refresh ? boost::beast::http::verb::put
+                                           : boost::beast::http::verb::post;
+            }
+
+            // The push itself completes asynchronously on the io_context
+            if (!pipeline_->push(std::move(push)))
+            {
+                return opentelemetry::sdk::common::ExportResult::kFailure;
+            }
+            return opentelemetry::sdk::common::ExportResult::kSuccess;
+        }
+
+        static std::chrono::nanoseconds threadCpuTime() noexcept
+        {
+            timespec ts{};
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+            return std::chrono::seconds(ts.tv_sec) +
+                   std::chrono::nanoseconds(ts.tv_nsec);
+        }
+
+        /**
+         * gzip `body` when compression is enabled and it is large enough
+         */
+        PushPayload encode(std::string body)
+        {
+            if (!options_.compression ||
+                body.size() < options_.compression_min_size)
+            {
+                return PushPayload{std::move(body), {}, kContentType};
+            }
+            std::lock_guard<std::mutex> lock(compression_lock_);
+            PushPayload payload;
+            payload.content_type = kContentType;
+            auto start = threadCpuTime();
+            if (!compressor_.compress(body, payload.body))
+            {
+                return PushPayload{std::move(body), {}, kContentType};
+            }
+            auto cpu_time = threadCpuTime() - start;
+            payload.content_encoding = "gzip";
+
+            compression_stats_.payloads++;
+            compression_stats_.bytes_in += body.size();
+            compression_stats_.bytes_out += payload.body.size();
+            compression_stats_.cpu_time += cpu_time;
+            compression_stats_.last_ratio =
+                static_cast<double>(payload.body.size()) /
+                static_cast<double>(body.size());
+            OTEL_INTERNAL_LOG_DEBUG(
+                "[Prometheus Exporter] compressed " << body.size() << " -> "
+                << payload.body.size() << " bytes in "
+                << cpu_time.count() << " ns cpu");
+            return payload;
+        }
     };
 
 } // namespace bmctelemetry
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "opentelemetry/sdk/metrics/push_metric_exporter.h"
+
+#include "exporttelemetry.hpp"
+#include "metricsserver.hpp"
+#include "prometheustextwriter.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+namespace bmctelemetry
+{
+
+/**
+ * Where the pull mode /metrics endpoint listens. Only loopback by default;
+ * set address to "0.0.0.0" or an interface address to let remote
+ * scrapers in.
+ */
+struct PullEndpoint
+{
+    std::string address = "127.0.0.1";
+    unsigned short port = 9464;
+    std::string path = "/metrics";
+    // How long a connection may sit without sending a request, including
+    // between requests on a kept-alive connection
+    std::chrono::seconds idle_timeout{30};
+    // How long reading the rest of a request, and writing its response, may
+    // take once the request has started arriving
+    std::chrono::seconds read_timeout{10};
+};
+
+/**
+ * Exporter for pull mode. Each collection of the periodic reader is
+ * serialized once into a MetricsSnapshot, which MetricsHttpServer then hands
+ * to every scraper until the next collection replaces it.
+ */
+class PrometheusPullExporter final :
+    public opentelemetry::sdk::metrics::PushMetricExporter
+{
+  public:
+    explicit PrometheusPullExporter(
+        std::shared_ptr<MetricsSnapshot> snapshot,
+        opentelemetry::sdk::metrics::AggregationTemporality
+            aggregation_temporality = opentelemetry::sdk::metrics::
+                AggregationTemporality::kCumulative,
+        std::shared_ptr<ExportTelemetry> telemetry = nullptr) noexcept :
+        snapshot_(std::move(snapshot)), telemetry_(std::move(telemetry)),
+        aggregation_temporality_(aggregation_temporality)
+    {}
+
+    /**
+     * Export
+     * @param data metrics data
+     */
+    opentelemetry::sdk::common::ExportResult
+        Export(const opentelemetry::sdk::metrics::ResourceMetrics&
+                   data) noexcept override
+    {
+        if (isShutdown())
+        {
+            if (telemetry_)
+            {
+                telemetry_->recordExport(false);
+            }
+            return opentelemetry::sdk::common::ExportResult::kFailure;
+        }
+        const auto summaries = QuantileRegistry::globalInstance().collect();
+        std::lock_guard<std::mutex> lock(writer_lock_);
+        const auto start = ExportTelemetry::Clock::now();
+        std::string payload(writer_.write(data, false, false, summaries));
+        if (telemetry_)
+        {
+            telemetry_->recordSerialization(ExportTelemetry::Clock::now() -
+                                            start);
+            telemetry_->recordPayload(
+                payload.size(),
+                ExportTelemetry::countSeries(data) + summaries.size(),
+                ExportTelemetry::countOverflowSeries(data));
+            telemetry_->recordExport(true);
+        }
+        snapshot_->store(std::move(payload));
+        return opentelemetry::sdk::common::ExportResult::kSuccess;
+    }
+
+    /**
+     * Get the AggregationTemporality for the pull exporter
+     *
+     * @return AggregationTemporality
+     */
+    opentelemetry::sdk::metrics::AggregationTemporality
+        GetAggregationTemporality(opentelemetry::sdk::metrics::InstrumentType
+                                      instrument_type) const noexcept override
+    {
+        return aggregation_temporality_;
+    }
+
+    /**
+     * Force flush the exporter.
+     */
+    bool ForceFlush(std::chrono::microseconds timeout =
+                        (std::chrono::microseconds::max)()) noexcept override
+    {
+        return true;
+    }
+
+    /**
+     * Shut down the exporter.
+     * @param timeout an optional timeout.
+     * @return return the status of this operation
+     */
+    bool Shutdown(std::chrono::microseconds timeout =
+                      (std::chrono::microseconds::max)()) noexcept override
+    {
+        is_shutdown_ = true;
+        return true;
+    }
+
+  private:
+    std::shared_ptr<MetricsSnapshot> snapshot_;
+    std::shared_ptr<ExportTelemetry> telemetry_;
+    std::mutex writer_lock_;
+    PrometheusTextWriter writer_;
+
+    std::atomic<bool> is_shutdown_{false};
+    opentelemetry::sdk::metrics::AggregationTemporality
+        aggregation_temporality_;
+    bool isShutdown() const noexcept
+    {
+        return is_shutdown_;
+    }
+};
+
+} // namespace bmctelemetry
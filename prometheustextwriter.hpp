@@ -0,0 +1,728 @@
+#pragma once
+
+#include "opentelemetry/sdk/common/attributemap_hash.h"
+#include "opentelemetry/sdk/metrics/data/metric_data.h"
+#include "opentelemetry/sdk/metrics/export/metric_producer.h"
+
+#include "exporter_utils.hpp"
+
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace bmctelemetry
+{
+
+/**
+ * Writes OpenTelemetry metric data straight into the Prometheus text
+ * exposition format.
+ *
+ * This produces the same bytes as
+ * TextSerializer::Serialize(TranslateToPrometheus(...)), but without
+ * building MetricFamily/ClientMetric objects or going through an
+ * ostringstream. Output goes into an internal buffer that keeps its capacity
+ * between calls, so a steady state export does not allocate for the payload.
+ *
+ * The rendered label set of every series is cached per instrument, keyed by
+ * the hash of its attribute set, so a series that reports again only has its
+ * value formatted. Series that did not report in an export are evicted at
+ * the end of it.
+ *
+ * In change only mode a family is left out of the payload when none of its
+ * series changed value, appeared or disappeared since the previous write,
+ * except on every Nth write which is a full refresh. Families are kept or
+ * skipped as a whole because a pushgateway POST replaces all series of a
+ * metric name it receives.
+ */
+class PrometheusTextWriter
+{
+  public:
+    /**
+     * Serialize `data` into the internal buffer.
+     *
+     * @return a view of the serialized payload, valid until the next call
+     */
+    std::string_view write(const sdk::metrics::ResourceMetrics& data,
+                           bool populate_target_info, bool without_otel_scope,
+                           const std::vector<QuantileSnapshot>& summaries = {})
+    {
+        buffer_.clear();
+        ++epoch_;
+        skipped_families_ = 0;
+        full_refresh_ = change_only_refresh_cycles_ == 0 ||
+                        (epoch_ - 1) % change_only_refresh_cycles_ == 0 ||
+                        refresh_requested_;
+        refresh_requested_ = false;
+        if (without_otel_scope != without_otel_scope_)
+        {
+            instruments_.clear();
+            without_otel_scope_ = without_otel_scope;
+        }
+        if (populate_target_info && !data.scope_metric_data_.empty())
+        {
+            writeTarget(data, without_otel_scope
+                                  ? nullptr
+                                  : data.scope_metric_data_.begin()->scope_);
+        }
+        for (const auto& instrumentation_info : data.scope_metric_data_)
+        {
+            const opentelemetry::sdk::instrumentationscope::
+                InstrumentationScope* scope =
+                    without_otel_scope ? nullptr : instrumentation_info.scope_;
+            for (const auto& metric_data : instrumentation_info.metric_data_)
+            {
+                writeFamily(metric_data, scope, data.resource_);
+            }
+        }
+        std::erase_if(instruments_, [this](const auto& item) {
+            return item.second.last_seen != epoch_;
+        });
+        writeSummaries(summaries);
+        return buffer_;
+    }
+
+    /**
+     * Enable change only output with a full refresh every
+     * `full_refresh_every` writes; 0 disables it.
+     */
+    void setChangeOnly(std::uint32_t full_refresh_every) noexcept
+    {
+        change_only_refresh_cycles_ = full_refresh_every;
+    }
+
+    /**
+     * Make the next write a full refresh, e.g. because a change only
+     * payload never reached its destination
+     */
+    void requestFullRefresh() noexcept
+    {
+        refresh_requested_ = true;
+    }
+
+    /**
+     * Whether the last payload holds every family rather than only the
+     * changed ones
+     */
+    bool fullRefresh() const noexcept
+    {
+        return full_refresh_;
+    }
+
+    /**
+     * Families left out of the last payload because nothing changed
+     */
+    std::size_t skippedFamilies() const noexcept
+    {
+        return skipped_families_;
+    }
+
+    /**
+     * Number of series whose rendered labels are currently cached
+     */
+    std::size_t cachedSeries() const noexcept
+    {
+        std::size_t count = 0;
+        for (const auto& [key, instrument] : instruments_)
+        {
+            count += instrument.series.size();
+        }
+        return count;
+    }
+
+    std::size_t capacity() const noexcept
+    {
+        return buffer_.capacity();
+    }
+
+  private:
+    void writeFamily(
+        const sdk::metrics::MetricData& metric_data,
+        const opentelemetry::sdk::instrumentationscope::InstrumentationScope*
+            scope,
+        const opentelemetry::sdk::resource::Resource* resource)
+    {
+        if (metric_data.point_data_attr_.empty())
+        {
+            return;
+        }
+        const auto& front = metric_data.point_data_attr_.front();
+        auto kind =
+            PrometheusExporterUtils::getAggregationType(front.point_data);
+        bool is_monotonic = true;
+        if (kind == sdk::metrics::AggregationType::kSum)
+        {
+            is_monotonic =
+                nostd::get<sdk::metrics::SumPointData>(front.point_data)
+                    .is_monotonic_;
+        }
+        const auto type =
+            PrometheusExporterUtils::TranslateType(kind, is_monotonic);
+        name_ = PrometheusExporterUtils::GetNameCache().lookup(
+            metric_data.instrument_descriptor.name_,
+            metric_data.instrument_descriptor.unit_, type);
+        if (kind == sdk::metrics::AggregationType::kBase2ExponentialHistogram)
+        {
+            exponential_scale_ =
+                PrometheusExporterUtils::ExponentialExportScale(
+                    metric_data.instrument_descriptor.name_);
+        }
+
+        auto& instrument = instruments_[InstrumentKey{
+            scope, metric_data.instrument_descriptor.name_}];
+        instrument.last_seen = epoch_;
+
+        const auto family_begin = buffer_.size();
+        bool changed = false;
+        writeHeader(metric_data.instrument_descriptor.description_, type);
+        for (const auto& point_data_attr : metric_data.point_data_attr_)
+        {
+            auto& entry = seriesEntry(instrument, point_data_attr.attributes,
+                                      scope, resource, changed);
+            labels_ = &entry.labels;
+            changed |= writeSeries(point_data_attr.point_data, type, entry);
+        }
+        changed |= std::erase_if(instrument.series, [this](const auto& item) {
+            return item.second.last_seen != epoch_;
+        }) > 0;
+        if (!changed && !full_refresh_)
+        {
+            buffer_.resize(family_begin);
+            ++skipped_families_;
+        }
+    }
+
+    struct SeriesEntry
+    {
+        metric_sdk::PointAttributes attributes;
+        std::string labels;
+        std::uint64_t last_seen = 0;
+        // Value (or histogram sum) and histogram count of the last write
+        double last_value = 0.0;
+        std::uint64_t last_count = 0;
+
+        bool update(double value, std::uint64_t count) noexcept
+        {
+            bool changed = value != last_value || count != last_count;
+            last_value = value;
+            last_count = count;
+            return changed;
+        }
+    };
+
+    struct InstrumentEntry
+    {
+        std::unordered_multimap<std::size_t, SeriesEntry> series;
+        std::uint64_t last_seen = 0;
+    };
+
+    struct InstrumentKey
+    {
+        const opentelemetry::sdk::instrumentationscope::InstrumentationScope*
+            scope;
+        std::string name;
+
+        bool operator==(const InstrumentKey& other) const noexcept
+        {
+            return scope == other.scope && name == other.name;
+        }
+    };
+
+    struct InstrumentKeyHash
+    {
+        std::size_t operator()(const InstrumentKey& key) const noexcept
+        {
+            return std::hash<std::string>{}(key.name) ^
+                   (std::hash<const void*>{}(key.scope) << 1);
+        }
+    };
+
+    /**
+     * Return the cache entry for `attributes`, rendering its label set on
+     * first use. `created` is set when the entry is new.
+     */
+    SeriesEntry& seriesEntry(
+        InstrumentEntry& instrument,
+        const metric_sdk::PointAttributes& attributes,
+        const opentelemetry::sdk::instrumentationscope::InstrumentationScope*
+            scope,
+        const opentelemetry::sdk::resource::Resource* resource, bool& created)
+    {
+        const auto hash =
+            opentelemetry::sdk::common::GetHashForAttributeMap(attributes);
+        auto [begin, end] = instrument.series.equal_range(hash);
+        for (auto it = begin; it != end; ++it)
+        {
+            if (it->second.attributes == attributes)
+            {
+                it->second.last_seen = epoch_;
+                return it->second;
+            }
+        }
+        auto it = instrument.series.emplace(
+            hash, SeriesEntry{attributes, std::string{}, epoch_});
+        renderLabels(it->second.labels, attributes, scope, resource);
+        created = true;
+        return it->second;
+    }
+
+    void writeHeader(const std::string& help,
+                     prometheus_client::MetricType type)
+    {
+        if (!help.empty())
+        {
+            buffer_ += "# HELP ";
+            buffer_ += name_;
+            buffer_ += ' ';
+            buffer_ += help;
+            buffer_ += '\n';
+        }
+        buffer_ += "# TYPE ";
+        buffer_ += name_;
+        switch (type)
+        {
+            case prometheus_client::MetricType::Counter:
+                buffer_ += " counter\n";
+                break;
+            case prometheus_client::MetricType::Gauge:
+            case prometheus_client::MetricType::Info:
+                buffer_ += " gauge\n";
+                break;
+            case prometheus_client::MetricType::Histogram:
+                buffer_ += " histogram\n";
+                break;
+            case prometheus_client::MetricType::Summary:
+                buffer_ += " summary\n";
+                break;
+            default:
+                buffer_ += " untyped\n";
+                break;
+        }
+    }
+
+    /**
+     * Write one series
+     *
+     * @return whether its value differs from the last write
+     */
+    bool writeSeries(const metric_sdk::PointType& point_data,
+                     prometheus_client::MetricType type, SeriesEntry& entry)
+    {
+        if (nostd::holds_alternative<
+                sdk::metrics::Base2ExponentialHistogramPointData>(point_data))
+        {
+            return writeExponentialHistogram(
+                nostd::get<sdk::metrics::Base2ExponentialHistogramPointData>(
+                    point_data),
+                entry);
+        }
+        if (type == prometheus_client::MetricType::Histogram)
+        {
+            return writeHistogram(
+                nostd::get<sdk::metrics::HistogramPointData>(point_data),
+                entry);
+        }
+        const metric_sdk::ValueType* value = nullptr;
+        if (nostd::holds_alternative<sdk::metrics::SumPointData>(point_data))
+        {
+            value = &nostd::get<sdk::metrics::SumPointData>(point_data).value_;
+        }
+        else if (type == prometheus_client::MetricType::Gauge &&
+                 nostd::holds_alternative<sdk::metrics::LastValuePointData>(
+                     point_data))
+        {
+            value =
+                &nostd::get<sdk::metrics::LastValuePointData>(point_data).value_;
+        }
+        if (value == nullptr)
+        {
+            OTEL_INTERNAL_LOG_WARN(
+                "[Prometheus Exporter] PrometheusTextWriter - "
+                "invalid point data type");
+            return false;
+        }
+        double number = 0.0;
+        if (nostd::holds_alternative<int64_t>(*value))
+        {
+            number = static_cast<double>(nostd::get<int64_t>(*value));
+        }
+        else
+        {
+            number = nostd::get<double>(*value);
+        }
+        writeHead("");
+        appendDouble(number);
+        buffer_ += '\n';
+        return entry.update(number, 0);
+    }
+
+    bool writeHistogram(const sdk::metrics::HistogramPointData& point,
+                        SeriesEntry& entry)
+    {
+        double sum = 0.0;
+        if (nostd::holds_alternative<double>(point.sum_))
+        {
+            sum = nostd::get<double>(point.sum_);
+        }
+        else
+        {
+            sum = static_cast<double>(nostd::get<int64_t>(point.sum_));
+        }
+        writeHead("_count");
+        appendUnsigned(point.count_);
+        buffer_ += '\n';
+
+        writeHead("_sum");
+        appendDouble(sum);
+        buffer_ += '\n';
+
+        std::uint64_t cumulative = 0;
+        std::size_t idx = 0;
+        for (const auto& boundary : point.boundaries_)
+        {
+            cumulative += point.counts_[idx++];
+            writeBucket(boundary, cumulative);
+        }
+        cumulative += point.counts_[idx];
+        writeBucket(std::numeric_limits<double>::infinity(), cumulative);
+        return entry.update(sum, point.count_);
+    }
+
+    bool writeExponentialHistogram(
+        const sdk::metrics::Base2ExponentialHistogramPointData& point,
+        SeriesEntry& entry)
+    {
+        writeHead("_count");
+        appendUnsigned(point.count_);
+        buffer_ += '\n';
+
+        writeHead("_sum");
+        appendDouble(point.sum_);
+        buffer_ += '\n';
+
+        PrometheusExporterUtils::ForEachExponentialBucket(
+            point, exponential_scale_,
+            [this](double upper_bound, std::uint64_t cumulative) {
+            writeBucket(upper_bound, cumulative);
+        });
+        return entry.update(point.sum_, point.count_);
+    }
+
+    void writeBucket(double upper_bound, std::uint64_t cumulative)
+    {
+        writeHead("_bucket", "le", upper_bound);
+        appendUnsigned(cumulative);
+        buffer_ += '\n';
+    }
+
+    /**
+     * Summaries carry no labels and are always written; QuantileInstrument
+     * collection already makes them cumulative
+     */
+    void writeSummaries(const std::vector<QuantileSnapshot>& summaries)
+    {
+        static const std::string kNoLabels;
+        labels_ = &kNoLabels;
+        for (const auto& summary : summaries)
+        {
+            name_ = PrometheusExporterUtils::GetNameCache().lookup(
+                summary.name, summary.unit,
+                prometheus_client::MetricType::Summary);
+            writeHeader(summary.description,
+                        prometheus_client::MetricType::Summary);
+            writeHead("_count");
+            appendUnsigned(summary.count);
+            buffer_ += '\n';
+
+            writeHead("_sum");
+            appendDouble(summary.sum);
+            buffer_ += '\n';
+
+            for (const auto& [quantile, value] : summary.quantiles)
+            {
+                writeHead("", "quantile", quantile);
+                appendDouble(value);
+                buffer_ += '\n';
+            }
+        }
+    }
+
+    /**
+     * Write `name<suffix>{<labels>,<extra>="<extra_value>"} `, mirroring
+     * TextSerializer's WriteHead with an extra label
+     */
+    void writeHead(std::string_view suffix, std::string_view extra,
+                   double extra_value)
+    {
+        buffer_ += name_;
+        buffer_ += suffix;
+        buffer_ += '{';
+        if (!labels_->empty())
+        {
+            buffer_ += *labels_;
+            buffer_ += ',';
+        }
+        buffer_ += extra;
+        buffer_ += "=\"";
+        appendDouble(extra_value);
+        buffer_ += "\"} ";
+    }
+
+    /**
+     * Write `name<suffix>{<labels>} `, mirroring TextSerializer's WriteHead
+     */
+    void writeHead(std::string_view suffix)
+    {
+        buffer_ += name_;
+        buffer_ += suffix;
+        if (!labels_->empty())
+        {
+            buffer_ += '{';
+            buffer_ += *labels_;
+            buffer_ += '}';
+        }
+        buffer_ += ' ';
+    }
+
+    void writeTarget(
+        const sdk::metrics::ResourceMetrics& data,
+        const opentelemetry::sdk::instrumentationscope::InstrumentationScope*
+            scope)
+    {
+        if (data.resource_ == nullptr)
+        {
+            return;
+        }
+        name_ = "target";
+        writeHeader("Target metadata", prometheus_client::MetricType::Info);
+
+        metric_sdk::PointAttributes empty_attributes;
+        renderLabels(scratch_labels_, empty_attributes, scope, data.resource_);
+        for (const auto& label : data.resource_->GetAttributes())
+        {
+            openLabel(scratch_labels_);
+            AppendSanitized(scratch_labels_, label.first, SanitizeNameInto);
+            scratch_labels_ += "=\"";
+            appendAttributeValue(scratch_labels_, label.second);
+            scratch_labels_ += '"';
+        }
+        labels_ = &scratch_labels_;
+        writeHead("_info");
+        appendDouble(1.0);
+        buffer_ += '\n';
+    }
+
+    /**
+     * Render the label set of one series into `out` as `k="v",...`.
+     * Follows PrometheusExporterUtils::SetMetricBasic: values of keys that
+     * collide after sanitation are joined with ';' and keys that sort out
+     * of order after sanitation are dropped.
+     */
+    void renderLabels(
+        std::string& out, const metric_sdk::PointAttributes& labels,
+        const opentelemetry::sdk::instrumentationscope::InstrumentationScope*
+            scope,
+        const opentelemetry::sdk::resource::Resource* resource)
+    {
+        out.clear();
+        if (labels.empty() && nullptr == resource)
+        {
+            return;
+        }
+        bool open = false;
+        for (const auto& label : labels)
+        {
+            key_.clear();
+            AppendSanitized(key_, label.first, SanitizeLabelInto);
+            int comparison = open ? previous_key_.compare(key_) : -1;
+            if (comparison < 0) // new key
+            {
+                if (open)
+                {
+                    out += "\",";
+                }
+                out += key_;
+                out += "=\"";
+                appendAttributeValue(out, label.second);
+                previous_key_.swap(key_);
+                open = true;
+            }
+            else if (comparison == 0) // key collision after sanitation
+            {
+                out += ';';
+                appendAttributeValue(out, label.second);
+            }
+            else // order inversion introduced by sanitation
+            {
+                OTEL_INTERNAL_LOG_WARN(
+                    "[Prometheus Exporter] SetMetricBase - "
+                    "the sort order of labels has changed because of sanitization: '"
+                    << label.first << "' became '" << key_
+                    << "' which is less than '" << previous_key_
+                    << "'. Ignoring this label.");
+            }
+        }
+        if (open)
+        {
+            out += '"';
+        }
+        if (!scope)
+        {
+            return;
+        }
+        const auto& scope_name = scope->GetName();
+        if (!scope_name.empty())
+        {
+            openLabel(out);
+            out += kScopeNameKey;
+            out += "=\"";
+            appendEscaped(out, scope_name);
+            out += '"';
+        }
+        const auto& scope_version = scope->GetVersion();
+        if (!scope_version.empty())
+        {
+            openLabel(out);
+            out += kScopeVersionKey;
+            out += "=\"";
+            appendEscaped(out, scope_version);
+            out += '"';
+        }
+    }
+
+    static void openLabel(std::string& out)
+    {
+        if (!out.empty())
+        {
+            out += ',';
+        }
+    }
+
+    /**
+     * Append a label value, escaped as TextSerializer does: backslash,
+     * double quote and line feed.
+     */
+    static void appendEscaped(std::string& out, std::string_view value)
+    {
+        for (const char c : value)
+        {
+            switch (c)
+            {
+                case '\n':
+                    out += "\\n";
+                    break;
+                case '\\':
+                case '"':
+                    out += '\\';
+                    out += c;
+                    break;
+                default:
+                    out += c;
+                    break;
+            }
+        }
+    }
+
+    /**
+     * Same text as PrometheusExporterUtils::AttributeValueToString, escaped
+     */
+    static void appendAttributeValue(
+        std::string& out,
+        const opentelemetry::sdk::common::OwnedAttributeValue& value)
+    {
+        if (nostd::holds_alternative<bool>(value))
+        {
+            out += nostd::get<bool>(value) ? "true" : "false";
+        }
+        else if (nostd::holds_alternative<int>(value))
+        {
+            appendInteger(out, nostd::get<int>(value));
+        }
+        else if (nostd::holds_alternative<int64_t>(value))
+        {
+            appendInteger(out, nostd::get<int64_t>(value));
+        }
+        else if (nostd::holds_alternative<unsigned int>(value))
+        {
+            appendInteger(out, nostd::get<unsigned int>(value));
+        }
+        else if (nostd::holds_alternative<uint64_t>(value))
+        {
+            appendInteger(out, nostd::get<uint64_t>(value));
+        }
+        else if (nostd::holds_alternative<double>(value))
+        {
+            // std::to_string(double) formatting
+            char buf[std::numeric_limits<double>::max_exponent10 + 20];
+            int len = std::snprintf(buf, sizeof(buf), "%f",
+                                    nostd::get<double>(value));
+            out.append(buf, static_cast<std::size_t>(len));
+        }
+        else if (nostd::holds_alternative<std::string>(value))
+        {
+            appendEscaped(out, nostd::get<std::string>(value));
+        }
+        else
+        {
+            OTEL_INTERNAL_LOG_WARN(
+                "[Prometheus Exporter] AttributeValueToString - "
+                " Nested attributes not supported - ignored");
+        }
+    }
+
+    template <typename T>
+    static void appendInteger(std::string& out, T value)
+    {
+        char buf[24];
+        auto [ptr, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+        out.append(buf, ptr);
+    }
+
+    void appendUnsigned(std::uint64_t value)
+    {
+        appendInteger(buffer_, value);
+    }
+
+    /**
+     * Format a sample value or bucket bound the way TextSerializer does
+     */
+    void appendDouble(double value)
+    {
+        if (std::isnan(value))
+        {
+            buffer_ += "Nan";
+        }
+        else if (std::isinf(value))
+        {
+            buffer_ += value < 0 ? "-Inf" : "+Inf";
+        }
+        else
+        {
+            char buf[32];
+            auto [ptr, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+            buffer_.append(buf, ptr);
+        }
+    }
+
+    std::string buffer_;
+    std::string name_;
+    std::int32_t exponential_scale_ =
+        PrometheusExporterUtils::kExponentialBucketScale;
+    const std::string* labels_ = nullptr;
+    std::string scratch_labels_;
+    std::string key_;
+    std::string previous_key_;
+    std::unordered_map<InstrumentKey, InstrumentEntry, InstrumentKeyHash>
+        instruments_;
+    std::uint64_t epoch_ = 0;
+    bool without_otel_scope_ = false;
+    std::uint32_t change_only_refresh_cycles_ = 0;
+    bool full_refresh_ = true;
+    bool refresh_requested_ = false;
+    std::size_t skipped_families_ = 0;
+};
+
+} // namespace bmctelemetry
@@ -0,0 +1,281 @@
+#pragma once
+
+#include "exporttelemetry.hpp"
+#include "httppushclient.hpp"
+#include "opentelemetry/sdk/common/global_log_handler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+namespace bmctelemetry
+{
+
+/**
+ * A serialized payload and the headers describing it
+ */
+struct PushPayload
+{
+    std::string body;
+    // Empty for identity encoding, "gzip" for a compressed body
+    std::string content_encoding;
+    // Sent as Content-Type when not empty
+    std::string content_type;
+    // A Pushgateway keeps families missing from a POST body, while a PUT
+    // replaces everything it holds for the grouping key
+    boost::beast::http::verb method = boost::beast::http::verb::post;
+};
+
+/**
+ * Hands serialized payloads from the metric reader thread over to an
+ * HttpPushClient running on the reactor io_context.
+ *
+ * At most one payload is in flight and at most one waits behind it. When a
+ * push is still in flight, a newer payload replaces the waiting one instead
+ * of queueing behind it (latest wins), so a slow gateway never makes
+ * payloads pile up. A send counts as failed if the gateway does not answer
+ * with a 2xx status within the send timeout.
+ */
+class PushPipeline : public std::enable_shared_from_this<PushPipeline>
+{
+  public:
+    struct Stats
+    {
+        std::uint64_t queued = 0;
+        std::uint64_t coalesced = 0;
+        std::uint64_t dropped = 0;
+        std::uint64_t sent = 0;
+        std::uint64_t failed = 0;
+    };
+
+    /**
+     * `telemetry`, when set, gets the outcome and round trip time of every
+     * send. `verify_peer` is passed on to HttpPushClient.
+     */
+    PushPipeline(const std::string& url,
+                 boost::asio::io_context::executor_type ex,
+                 std::chrono::milliseconds send_timeout,
+                 std::shared_ptr<ExportTelemetry> telemetry = nullptr,
+                 bool verify_peer = false) :
+        client_(ex, url, verify_peer), ex_(ex), timer_(ex), send_timeout_(send_timeout),
+        telemetry_(std::move(telemetry))
+    {}
+
+    /**
+     * Queue `payload` for sending, replacing any payload that has not been
+     * sent yet. Safe to call from any thread.
+     *
+     * @return false if the pipeline is closed and the payload was dropped
+     */
+    bool push(PushPayload payload)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closed_)
+        {
+            ++stats_.dropped;
+            return false;
+        }
+        if (pending_)
+        {
+            ++stats_.coalesced;
+        }
+        else
+        {
+            ++stats_.queued;
+        }
+        pending_ = std::move(payload);
+        scheduleDispatch();
+        return true;
+    }
+
+    /**
+     * Report completion of send number `generation`. Must run on the
+     * io_context, as the HttpPushClient completion does.
+     */
+    void onComplete(std::uint64_t generation, bool success)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!in_flight_ || generation != generation_)
+        {
+            // A send that was already counted as timed out
+            return;
+        }
+        timer_.cancel();
+        finish(success);
+    }
+
+    /**
+     * Block until nothing is queued or in flight, or until `timeout`. The
+     * wait never exceeds what the send in flight and the one waiting behind
+     * it can take, so an unbounded timeout cannot hang on a stopped
+     * io_context. Must not be called on the io_context, which would wait on
+     * itself; it fails right away there.
+     *
+     * @return true if the pipeline drained
+     */
+    bool waitIdle(std::chrono::microseconds timeout)
+    {
+        if (ex_.running_in_this_thread())
+        {
+            OTEL_INTERNAL_LOG_ERROR(
+                "[Push Pipeline] waitIdle called on the io_context");
+            return false;
+        }
+        const auto limit =
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                2 * (send_timeout_ + kDispatchSlack));
+        std::unique_lock<std::mutex> lock(mutex_);
+        return idle_.wait_for(lock, (std::min)(timeout, limit), [this] {
+            return closed_ || (!pending_ && !in_flight_);
+        });
+    }
+
+    /**
+     * Stop accepting payloads. A payload that is still waiting is dropped.
+     */
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        if (pending_)
+        {
+            ++stats_.dropped;
+            pending_.reset();
+        }
+        idle_.notify_all();
+    }
+
+    Stats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+  private:
+    // Time allowed for a posted dispatch to reach a busy io_context
+    static constexpr std::chrono::milliseconds kDispatchSlack{1000};
+
+    // Called with mutex_ held
+    void scheduleDispatch()
+    {
+        if (in_flight_ || dispatch_scheduled_)
+        {
+            return;
+        }
+        dispatch_scheduled_ = true;
+        boost::asio::post(ex_, [weak = weak_from_this()] {
+            if (auto self = weak.lock())
+            {
+                self->dispatch();
+            }
+        });
+    }
+
+    // Runs on the io_context
+    void dispatch()
+    {
+        PushPayload payload;
+        std::uint64_t generation = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            dispatch_scheduled_ = false;
+            if (closed_ || in_flight_ || !pending_)
+            {
+                return;
+            }
+            payload = std::move(*pending_);
+            pending_.reset();
+            in_flight_ = true;
+            sent_at_ = ExportTelemetry::Clock::now();
+            generation = ++generation_;
+            armTimer(generation);
+        }
+        boost::beast::http::fields headers;
+        if (!payload.content_type.empty())
+        {
+            headers.set(boost::beast::http::field::content_type,
+                        payload.content_type);
+        }
+        if (!payload.content_encoding.empty())
+        {
+            headers.set(boost::beast::http::field::content_encoding,
+                        payload.content_encoding);
+        }
+        client_.send(payload.method, std::move(payload.body),
+                     std::move(headers),
+                     [weak = weak_from_this(), generation](bool success) {
+            if (auto self = weak.lock())
+            {
+                self->onComplete(generation, success);
+            }
+        });
+    }
+
+    // Called with mutex_ held, on the io_context. HttpSubscriber reports no
+    // failures, so a send that has not completed by then counts as failed.
+    void armTimer(std::uint64_t generation)
+    {
+        timer_.expires_after(send_timeout_);
+        timer_.async_wait([weak = weak_from_this(),
+                           generation](const boost::system::error_code& ec) {
+            auto self = weak.lock();
+            if (ec || !self)
+            {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            if (self->in_flight_ && self->generation_ == generation)
+            {
+                self->finish(false);
+            }
+        });
+    }
+
+    // Called with mutex_ held
+    void finish(bool success)
+    {
+        in_flight_ = false;
+        if (success)
+        {
+            ++stats_.sent;
+        }
+        else
+        {
+            ++stats_.failed;
+        }
+        if (telemetry_)
+        {
+            telemetry_->recordPush(success,
+                                   ExportTelemetry::Clock::now() - sent_at_);
+        }
+        if (pending_ && !closed_)
+        {
+            scheduleDispatch();
+        }
+        idle_.notify_all();
+    }
+
+    HttpPushClient client_;
+    boost::asio::io_context::executor_type ex_;
+    boost::asio::steady_timer timer_;
+    std::chrono::milliseconds send_timeout_;
+    std::shared_ptr<ExportTelemetry> telemetry_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable idle_;
+    std::optional<PushPayload> pending_;
+    bool in_flight_ = false;
+    bool dispatch_scheduled_ = false;
+    bool closed_ = false;
+    // Sequence number of the latest send
+    std::uint64_t generation_ = 0;
+    ExportTelemetry::Clock::time_point sent_at_;
+    Stats stats_;
+};
+
+} // namespace bmctelemetry
@@ -0,0 +1,489 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bmctelemetry
+{
+
+/**
+ * Counts of a DDSketch for one sign, in consecutive bins starting at
+ * `offset`. When the bins would span more than `max_bins` indices, the
+ * lowest ones are folded into the lowest kept bin, so accuracy is given up
+ * at the low end and kept for the high quantiles.
+ */
+class SketchStore
+{
+  public:
+    explicit SketchStore(std::size_t max_bins) : max_bins_(max_bins) {}
+
+    void add(std::int32_t index, std::uint64_t count = 1)
+    {
+        if (bins_.empty())
+        {
+            offset_ = index;
+            bins_.push_back(0);
+        }
+        else if (index < offset_)
+        {
+            auto grow = static_cast<std::size_t>(offset_ - index);
+            if (bins_.size() + grow > max_bins_)
+            {
+                // Below the range we keep: count it in the lowest bin
+                grow = max_bins_ - bins_.size();
+                index = offset_ - static_cast<std::int32_t>(grow);
+            }
+            bins_.insert(bins_.begin(), grow, 0);
+            offset_ -= static_cast<std::int32_t>(grow);
+        }
+        else if (auto last = offset_ + static_cast<std::int32_t>(bins_.size());
+                 index >= last)
+        {
+            bins_.resize(bins_.size() + static_cast<std::size_t>(index - last) +
+                         1);
+            collapse();
+        }
+        bins_[static_cast<std::size_t>(std::max(index, offset_) - offset_)] +=
+            count;
+    }
+
+    void merge(const SketchStore& other)
+    {
+        for (std::size_t i = 0; i < other.bins_.size(); ++i)
+        {
+            if (other.bins_[i] != 0)
+            {
+                add(other.offset_ + static_cast<std::int32_t>(i),
+                    other.bins_[i]);
+            }
+        }
+    }
+
+    void clear() noexcept
+    {
+        bins_.clear();
+    }
+
+    /**
+     * Call `visit(index, count)` for every non empty bin, lowest index
+     * first, until it returns true
+     */
+    template <typename Visit>
+    bool forEach(Visit&& visit) const
+    {
+        for (std::size_t i = 0; i < bins_.size(); ++i)
+        {
+            if (bins_[i] != 0 &&
+                visit(offset_ + static_cast<std::int32_t>(i), bins_[i]))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Same as forEach, highest index first
+     */
+    template <typename Visit>
+    bool forEachReverse(Visit&& visit) const
+    {
+        for (std::size_t i = bins_.size(); i-- > 0;)
+        {
+            if (bins_[i] != 0 &&
+                visit(offset_ + static_cast<std::int32_t>(i), bins_[i]))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+  private:
+    void collapse()
+    {
+        if (bins_.size() <= max_bins_)
+        {
+            return;
+        }
+        const auto excess = bins_.size() - max_bins_;
+        std::uint64_t folded = 0;
+        for (std::size_t i = 0; i <= excess; ++i)
+        {
+            folded += bins_[i];
+        }
+        bins_.erase(bins_.begin(),
+                    bins_.begin() + static_cast<std::ptrdiff_t>(excess));
+        bins_.front() = folded;
+        offset_ += static_cast<std::int32_t>(excess);
+    }
+
+    std::size_t max_bins_;
+    std::int32_t offset_ = 0;
+    std::vector<std::uint64_t> bins_;
+};
+
+/**
+ * DDSketch quantile sketch (Masson et al., VLDB 2019). Every quantile it
+ * returns is within `relative_accuracy` of the exact value, as long as the
+ * bin limit has not folded the low end. Memory is bounded by `max_bins` per
+ * sign, and sketches with the same parameters merge exactly.
+ */
+class QuantileSketch
+{
+  public:
+    explicit QuantileSketch(double relative_accuracy = 0.01,
+                            std::size_t max_bins = 2048) :
+        gamma_((1 + relative_accuracy) / (1 - relative_accuracy)),
+        log_gamma_(std::log(gamma_)), positive_(max_bins), negative_(max_bins)
+    {}
+
+    void record(double value)
+    {
+        if (std::isnan(value))
+        {
+            return;
+        }
+        if (value > kMinIndexable)
+        {
+            positive_.add(index(value));
+        }
+        else if (value < -kMinIndexable)
+        {
+            negative_.add(index(-value));
+        }
+        else
+        {
+            ++zero_count_;
+        }
+        ++count_;
+        sum_ += value;
+    }
+
+    void merge(const QuantileSketch& other)
+    {
+        positive_.merge(other.positive_);
+        negative_.merge(other.negative_);
+        zero_count_ += other.zero_count_;
+        count_ += other.count_;
+        sum_ += other.sum_;
+    }
+
+    void clear() noexcept
+    {
+        positive_.clear();
+        negative_.clear();
+        zero_count_ = 0;
+        count_ = 0;
+        sum_ = 0;
+    }
+
+    /**
+     * Value at quantile `q` in [0, 1]; NaN when nothing was recorded
+     */
+    double quantile(double q) const
+    {
+        if (count_ == 0 || q < 0 || q > 1)
+        {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        const auto rank =
+            static_cast<std::uint64_t>(q * static_cast<double>(count_ - 1));
+        std::uint64_t seen = 0;
+        double result = 0;
+        auto find = [&](bool negative) {
+            return [&, negative](std::int32_t index, std::uint64_t count) {
+                seen += count;
+                if (seen <= rank)
+                {
+                    return false;
+                }
+                result = negative ? -value(index) : value(index);
+                return true;
+            };
+        };
+        // Most negative values first, i.e. the highest negative indices
+        if (negative_.forEachReverse(find(true)))
+        {
+            return result;
+        }
+        seen += zero_count_;
+        if (seen > rank)
+        {
+            return 0;
+        }
+        positive_.forEach(find(false));
+        return result;
+    }
+
+    std::uint64_t count() const noexcept
+    {
+        return count_;
+    }
+    double sum() const noexcept
+    {
+        return sum_;
+    }
+
+  private:
+    static constexpr double kMinIndexable = 1e-300;
+
+    std::int32_t index(double value) const
+    {
+        return static_cast<std::int32_t>(std::ceil(std::log(value) / log_gamma_));
+    }
+    // Midpoint of bin `index` in relative terms
+    double value(std::int32_t index) const
+    {
+        return 2 * std::pow(gamma_, index) / (gamma_ + 1);
+    }
+
+    double gamma_;
+    double log_gamma_;
+    SketchStore positive_;
+    SketchStore negative_;
+    std::uint64_t zero_count_ = 0;
+    std::uint64_t count_ = 0;
+    double sum_ = 0;
+};
+
+/**
+ * Quantiles of one instrument at collection time
+ */
+struct QuantileSnapshot
+{
+    std::string name;
+    std::string description;
+    std::string unit;
+    // (quantile, value) pairs
+    std::vector<std::pair<double, double>> quantiles;
+    double sum = 0;
+    std::uint64_t count = 0;
+};
+
+/**
+ * Instrument that reports quantiles of recorded values as a Prometheus
+ * Summary. Each recording thread fills its own sketch; collection merges
+ * them, so Record never contends across threads.
+ *
+ * Like prometheus-cpp's Summary, quantiles cover a sliding window of
+ * `max_age`, kept as `age_buckets` sketches that each start
+ * max_age / age_buckets later than the previous one. The oldest is
+ * reported and cleared once it is max_age old. Values enter the window
+ * when they are collected, so its edges move in steps of the export
+ * interval. _sum and _count stay cumulative, as Prometheus expects. A zero
+ * max_age reports quantiles over the whole lifetime.
+ */
+class QuantileInstrument
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    QuantileInstrument(std::string name, std::string description,
+                       std::string unit, std::vector<double> quantiles,
+                       double relative_accuracy = 0.01,
+                       std::size_t max_bins = 2048,
+                       std::chrono::seconds max_age = std::chrono::seconds(60),
+                       std::size_t age_buckets = 5) :
+        name_(std::move(name)), description_(std::move(description)),
+        unit_(std::move(unit)), quantiles_(std::move(quantiles)),
+        relative_accuracy_(relative_accuracy), max_bins_(max_bins),
+        id_(nextId()), age_buckets_(max_age.count() == 0
+                                        ? 1
+                                        : std::max<std::size_t>(age_buckets,
+                                                                1)),
+        bucket_width_(Clock::duration(max_age) /
+                      static_cast<Clock::rep>(age_buckets_)),
+        window_(age_buckets_, QuantileSketch(relative_accuracy, max_bins)),
+        rotated_at_(Clock::now())
+    {}
+    QuantileInstrument(const QuantileInstrument&) = delete;
+    QuantileInstrument& operator=(const QuantileInstrument&) = delete;
+
+    void Record(double value)
+    {
+        auto& shard = localShard();
+        std::lock_guard<std::mutex> lock(shard.lock);
+        shard.sketch.record(value);
+    }
+
+    /**
+     * Merge what every thread recorded since the last collection and
+     * report the configured quantiles over the window ending at `now`
+     */
+    QuantileSnapshot collect(Clock::time_point now = Clock::now())
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rotate(now);
+        for (auto& shard : shards_)
+        {
+            std::lock_guard<std::mutex> shardLock(shard->lock);
+            for (auto& sketch : window_)
+            {
+                sketch.merge(shard->sketch);
+            }
+            sum_ += shard->sketch.sum();
+            count_ += shard->sketch.count();
+            shard->sketch.clear();
+        }
+        // Forget shards of threads that have exited
+        std::erase_if(shards_, [](const std::shared_ptr<Shard>& shard) {
+            return shard.use_count() == 1;
+        });
+
+        QuantileSnapshot snapshot{name_, description_, unit_, {}, sum_,
+                                  count_};
+        snapshot.quantiles.reserve(quantiles_.size());
+        const auto& oldest = window_[head_];
+        for (double q : quantiles_)
+        {
+            snapshot.quantiles.emplace_back(q, oldest.quantile(q));
+        }
+        return snapshot;
+    }
+
+  private:
+    struct Shard
+    {
+        Shard(double relative_accuracy, std::size_t max_bins) :
+            sketch(relative_accuracy, max_bins)
+        {}
+        std::mutex lock;
+        QuantileSketch sketch;
+    };
+
+    static std::uint64_t nextId()
+    {
+        static std::atomic<std::uint64_t> id{0};
+        return ++id;
+    }
+
+    /**
+     * Clear the sketches that have aged out of the window. Called with
+     * mutex_ held.
+     */
+    void rotate(Clock::time_point now)
+    {
+        if (bucket_width_ == Clock::duration::zero())
+        {
+            return;
+        }
+        if (now - rotated_at_ >= bucket_width_ * window_.size())
+        {
+            // Idle for a whole window
+            for (auto& sketch : window_)
+            {
+                sketch.clear();
+            }
+            rotated_at_ = now;
+            return;
+        }
+        while (now - rotated_at_ >= bucket_width_)
+        {
+            window_[head_].clear();
+            head_ = (head_ + 1) % window_.size();
+            rotated_at_ += bucket_width_;
+        }
+    }
+
+    Shard& localShard()
+    {
+        // A thread may record into several instruments
+        thread_local std::vector<std::pair<std::uint64_t, std::shared_ptr<Shard>>>
+            shards;
+        for (const auto& [owner, shard] : shards)
+        {
+            if (owner == id_)
+            {
+                return *shard;
+            }
+        }
+        auto shard = std::make_shared<Shard>(relative_accuracy_, max_bins_);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            shards_.push_back(shard);
+        }
+        shards.emplace_back(id_, shard);
+        return *shard;
+    }
+
+    std::string name_;
+    std::string description_;
+    std::string unit_;
+    std::vector<double> quantiles_;
+    double relative_accuracy_;
+    std::size_t max_bins_;
+    const std::uint64_t id_;
+
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<Shard>> shards_;
+    const std::size_t age_buckets_;
+    const Clock::duration bucket_width_;
+    // window_[head_] is the oldest sketch and the one reported
+    std::vector<QuantileSketch> window_;
+    std::size_t head_ = 0;
+    Clock::time_point rotated_at_;
+    double sum_ = 0;
+    std::uint64_t count_ = 0;
+};
+
+/**
+ * The quantile instruments the Prometheus exporters collect from
+ */
+class QuantileRegistry
+{
+  public:
+    void add(const std::shared_ptr<QuantileInstrument>& instrument)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        instruments_.push_back(instrument);
+    }
+
+    /**
+     * Snapshot of every live instrument
+     */
+    std::vector<QuantileSnapshot> collect()
+    {
+        std::vector<std::shared_ptr<QuantileInstrument>> live;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::erase_if(instruments_, [&live](const auto& weak) {
+                auto instrument = weak.lock();
+                if (!instrument)
+                {
+                    return true;
+                }
+                live.push_back(std::move(instrument));
+                return false;
+            });
+        }
+        std::vector<QuantileSnapshot> snapshots;
+        snapshots.reserve(live.size());
+        for (const auto& instrument : live)
+        {
+            snapshots.push_back(instrument->collect());
+        }
+        return snapshots;
+    }
+
+    static QuantileRegistry& globalInstance()
+    {
+        static QuantileRegistry registry;
+        return registry;
+    }
+
+  private:
+    std::mutex mutex_;
+    std::vector<std::weak_ptr<QuantileInstrument>> instruments_;
+};
+
+} // namespace bmctelemetry
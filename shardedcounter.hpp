@@ -0,0 +1,95 @@
+#pragma once
+
+#include "opentelemetry/metrics/async_instruments.h"
+#include "opentelemetry/metrics/observer_result.h"
+#include "opentelemetry/nostd/shared_ptr.h"
+#include "opentelemetry/nostd/variant.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace bmctelemetry
+{
+
+/**
+ * Monotonic counter for call sites that Add from many threads at a high
+ * rate. Each thread adds into its own cache line sized slot, so Add is a
+ * single uncontended atomic update. The slots are summed only when the
+ * metric reader collects, through the callback of an observable counter.
+ *
+ * Threads are spread over kSlots slots; beyond that many threads, slots are
+ * shared but stay correct.
+ */
+class ShardedCounter
+{
+  public:
+    static constexpr std::size_t kSlots = 64;
+
+    explicit ShardedCounter(
+        opentelemetry::nostd::shared_ptr<
+            opentelemetry::metrics::ObservableInstrument>
+            instrument) : instrument_(std::move(instrument))
+    {
+        instrument_->AddCallback(observe, this);
+    }
+    ShardedCounter(const ShardedCounter&) = delete;
+    ShardedCounter& operator=(const ShardedCounter&) = delete;
+    ~ShardedCounter()
+    {
+        instrument_->RemoveCallback(observe, this);
+    }
+
+    void Add(double value) noexcept
+    {
+        slots_[slotIndex()].value.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    /**
+     * Sum of all slots; what the next collection will report
+     */
+    double value() const noexcept
+    {
+        double sum = 0;
+        for (const auto& slot : slots_)
+        {
+            sum += slot.value.load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+  private:
+    static constexpr std::size_t kCacheLine = 64;
+
+    struct alignas(kCacheLine) Slot
+    {
+        std::atomic<double> value{0};
+    };
+
+    static std::size_t slotIndex() noexcept
+    {
+        static std::atomic<std::size_t> nextThread{0};
+        thread_local const std::size_t index =
+            nextThread.fetch_add(1, std::memory_order_relaxed) % kSlots;
+        return index;
+    }
+
+    static void observe(opentelemetry::metrics::ObserverResult result,
+                        void* state)
+    {
+        using DoubleResult = opentelemetry::nostd::shared_ptr<
+            opentelemetry::metrics::ObserverResultT<double>>;
+        if (opentelemetry::nostd::holds_alternative<DoubleResult>(result))
+        {
+            opentelemetry::nostd::get<DoubleResult>(result)->Observe(
+                static_cast<ShardedCounter*>(state)->value());
+        }
+    }
+
+    std::array<Slot, kSlots> slots_;
+    opentelemetry::nostd::shared_ptr<
+        opentelemetry::metrics::ObservableInstrument>
+        instrument_;
+};
+
+} // namespace bmctelemetry
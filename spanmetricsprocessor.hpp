@@ -0,0 +1,461 @@
+#pragma once
+
+#include "opentelemetry/common/key_value_iterable_view.h"
+#include "opentelemetry/context/context.h"
+#include "opentelemetry/metrics/async_instruments.h"
+#include "opentelemetry/metrics/observer_result.h"
+#include "opentelemetry/metrics/provider.h"
+#include "opentelemetry/metrics/sync_instruments.h"
+#include "opentelemetry/sdk/trace/processor.h"
+#include "opentelemetry/sdk/trace/recordable.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace bmctelemetry
+{
+
+/**
+ * Struct to hold span metrics options.
+ */
+struct SpanMetricsOptions
+{
+    // Meter and instrument name prefix, giving <prefix>_calls,
+    // <prefix>_errors and <prefix>_duration
+    std::string prefix = "span";
+    // Spans a thread aggregates before it updates the instruments
+    std::size_t flush_every = 64;
+    // Longest time a thread holds aggregated spans, checked on span end
+    std::chrono::milliseconds flush_interval = std::chrono::milliseconds(1000);
+    // Bucket boundaries durations are aggregated with in ms, the SDK
+    // defaults. A view on <prefix>_duration should use the same ones.
+    std::vector<double> duration_boundaries{0,   5,    10,   25,   50,
+                                            75,  100,  250,  500,  750,
+                                            1000, 2500, 5000, 7500, 10000};
+};
+
+/**
+ * Span processor that turns ended spans into RED metrics instead of
+ * exporting them: a call counter, an error counter and a duration histogram
+ * (in ms), each with a span_name attribute.
+ *
+ * Every thread aggregates into its own shard, so ending a span takes only an
+ * uncontended lock. A shard is applied to the instruments once it holds
+ * flush_every spans, once flush_interval has passed, on ForceFlush, and at
+ * every collection through the callback of the <prefix>_threads gauge, so
+ * a thread that stops ending spans does not hold its last ones back. The
+ * instruments belong to the global meter provider; they are created lazily
+ * and recreated if the provider changes, so the tracer may be set up before
+ * OtelMetrics.
+ *
+ * Durations are counted into duration_boundaries buckets in the shard. A
+ * flush replays each bucket into the SDK histogram with the bucket's mean
+ * (and the exact min and max), so views, limits and every reader apply,
+ * and count, sum, min, max and bucket counts come out exact.
+ *
+ * Only spans the head sampler records reach the processor. With a ratio or
+ * rate limited sampler the metrics count sampled spans, not all of them.
+ */
+class SpanMetricsProcessor final :
+    public opentelemetry::sdk::trace::SpanProcessor
+{
+    using Recordable = opentelemetry::sdk::trace::Recordable;
+
+  public:
+    explicit SpanMetricsProcessor(const SpanMetricsOptions& options = {}) :
+        options_(options), id_(nextId())
+    {
+        std::sort(options_.duration_boundaries.begin(),
+                  options_.duration_boundaries.end());
+    }
+    SpanMetricsProcessor(const SpanMetricsProcessor&) = delete;
+    SpanMetricsProcessor& operator=(const SpanMetricsProcessor&) = delete;
+    ~SpanMetricsProcessor() override
+    {
+        Threads threads;
+        {
+            std::lock_guard<std::mutex> lock(instruments_lock_);
+            threads = std::move(instruments_.threads);
+        }
+        // Outside the lock, which a running callback may be waiting for
+        if (threads)
+        {
+            threads->RemoveCallback(observeThreads, this);
+        }
+    }
+
+    std::unique_ptr<Recordable> MakeRecordable() noexcept override
+    {
+        return std::make_unique<MetricsRecordable>();
+    }
+
+    void OnStart(Recordable&,
+                 const opentelemetry::trace::SpanContext&) noexcept override
+    {}
+
+    void OnEnd(std::unique_ptr<Recordable>&& span) noexcept override
+    {
+        auto& recordable = static_cast<MetricsRecordable&>(*span);
+        auto& shard = localShard();
+        bool flush = false;
+        {
+            std::lock_guard<std::mutex> lock(shard.lock);
+            auto& series = shard.series[recordable.name];
+            ++series.calls;
+            series.errors += recordable.error ? 1 : 0;
+            series.durations.record(
+                std::chrono::duration<double, std::milli>(recordable.duration)
+                    .count(),
+                options_.duration_boundaries);
+            auto now = std::chrono::steady_clock::now();
+            if (++shard.pending >= options_.flush_every ||
+                now - shard.last_flush >= options_.flush_interval)
+            {
+                flush = true;
+                shard.last_flush = now;
+            }
+        }
+        if (flush)
+        {
+            std::lock_guard<std::mutex> lock(instruments_lock_);
+            refreshInstruments();
+            flushShard(shard);
+        }
+    }
+
+    bool ForceFlush(std::chrono::microseconds =
+                        (std::chrono::microseconds::max)()) noexcept override
+    {
+        std::lock_guard<std::mutex> lock(instruments_lock_);
+        refreshInstruments();
+        flushShards();
+        return true;
+    }
+
+    bool Shutdown(std::chrono::microseconds timeout =
+                      (std::chrono::microseconds::max)()) noexcept override
+    {
+        return ForceFlush(timeout);
+    }
+
+  private:
+    struct MetricsRecordable final : Recordable
+    {
+        void SetIdentity(const opentelemetry::trace::SpanContext&,
+                         opentelemetry::trace::SpanId) noexcept override
+        {}
+        void SetAttribute(opentelemetry::nostd::string_view,
+                          const opentelemetry::common::AttributeValue&) noexcept
+            override
+        {}
+        void AddEvent(opentelemetry::nostd::string_view,
+                      opentelemetry::common::SystemTimestamp,
+                      const opentelemetry::common::KeyValueIterable&) noexcept
+            override
+        {}
+        void AddLink(const opentelemetry::trace::SpanContext&,
+                     const opentelemetry::common::KeyValueIterable&) noexcept
+            override
+        {}
+        void SetStatus(opentelemetry::trace::StatusCode code,
+                       opentelemetry::nostd::string_view) noexcept override
+        {
+            error = code == opentelemetry::trace::StatusCode::kError;
+        }
+        void SetName(opentelemetry::nostd::string_view span_name) noexcept
+            override
+        {
+            name.assign(span_name.data(), span_name.size());
+        }
+        void SetSpanKind(opentelemetry::trace::SpanKind) noexcept override {}
+        void SetResource(
+            const opentelemetry::sdk::resource::Resource&) noexcept override
+        {}
+        void SetStartTime(
+            opentelemetry::common::SystemTimestamp) noexcept override
+        {}
+        void SetDuration(std::chrono::nanoseconds span_duration) noexcept
+            override
+        {
+            duration = span_duration;
+        }
+        void SetInstrumentationScope(
+            const opentelemetry::sdk::instrumentationscope::
+                InstrumentationScope&) noexcept override
+        {}
+
+        std::string name;
+        std::chrono::nanoseconds duration{0};
+        bool error = false;
+    };
+
+    /**
+     * Durations counted against duration_boundaries, with the sum of each
+     * bucket so a flush can replay them exactly
+     */
+    struct Durations
+    {
+        std::vector<std::uint64_t> counts;
+        std::vector<double> sums;
+        double min = std::numeric_limits<double>::infinity();
+        double max = -std::numeric_limits<double>::infinity();
+
+        void record(double value, const std::vector<double>& boundaries)
+        {
+            if (counts.empty())
+            {
+                counts.resize(boundaries.size() + 1);
+                sums.resize(boundaries.size() + 1);
+            }
+            // Upper bounds are inclusive, as in the SDK
+            const auto bucket = static_cast<std::size_t>(
+                std::lower_bound(boundaries.begin(), boundaries.end(),
+                                 value) -
+                boundaries.begin());
+            ++counts[bucket];
+            sums[bucket] += value;
+            min = std::min(min, value);
+            max = std::max(max, value);
+        }
+    };
+
+    struct Series
+    {
+        std::uint64_t calls = 0;
+        std::uint64_t errors = 0;
+        Durations durations;
+    };
+
+    struct Shard
+    {
+        std::mutex lock;
+        std::unordered_map<std::string, Series> series;
+        std::size_t pending = 0;
+        std::chrono::steady_clock::time_point last_flush =
+            std::chrono::steady_clock::now();
+    };
+
+    using Threads = opentelemetry::nostd::shared_ptr<
+        opentelemetry::metrics::ObservableInstrument>;
+
+    struct Instruments
+    {
+        // Only compared against, never dereferenced
+        const opentelemetry::metrics::MeterProvider* provider = nullptr;
+        opentelemetry::nostd::unique_ptr<
+            opentelemetry::metrics::Counter<std::uint64_t>>
+            calls;
+        opentelemetry::nostd::unique_ptr<
+            opentelemetry::metrics::Counter<std::uint64_t>>
+            errors;
+        opentelemetry::nostd::unique_ptr<
+            opentelemetry::metrics::Histogram<double>>
+            duration;
+        // Its callback flushes every shard at collection
+        Threads threads;
+    };
+
+    Shard& localShard()
+    {
+        struct LocalShard
+        {
+            std::uint64_t owner = 0;
+            std::shared_ptr<Shard> shard;
+        };
+        thread_local LocalShard local;
+        if (local.owner != id_) [[unlikely]]
+        {
+            local.shard = std::make_shared<Shard>();
+            local.owner = id_;
+            std::lock_guard<std::mutex> lock(registry_lock_);
+            shards_.push_back(local.shard);
+        }
+        return *local.shard;
+    }
+
+    // Called with instruments_lock_ held
+    void flushShards()
+    {
+        std::vector<std::shared_ptr<Shard>> shards;
+        {
+            std::lock_guard<std::mutex> lock(registry_lock_);
+            // Forget shards of threads that have exited, once flushed below
+            shards.swap(shards_);
+            for (const auto& shard : shards)
+            {
+                if (shard.use_count() > 1)
+                {
+                    shards_.push_back(shard);
+                }
+            }
+        }
+        for (auto& shard : shards)
+        {
+            flushShard(*shard);
+        }
+    }
+
+    // Called with instruments_lock_ held
+    void flushShard(Shard& shard)
+    {
+        std::unordered_map<std::string, Series> series;
+        {
+            std::lock_guard<std::mutex> lock(shard.lock);
+            if (shard.pending == 0)
+            {
+                return;
+            }
+            series.swap(shard.series);
+            shard.pending = 0;
+        }
+
+        for (const auto& [name, values] : series)
+        {
+            std::array<std::pair<opentelemetry::nostd::string_view,
+                                 opentelemetry::common::AttributeValue>,
+                       1>
+                attributes{{{"span_name", opentelemetry::nostd::string_view(
+                                              name.data(), name.size())}}};
+            auto labelkv = opentelemetry::common::KeyValueIterableView<
+                decltype(attributes)>{attributes};
+            instruments_.calls->Add(values.calls, labelkv);
+            if (values.errors != 0)
+            {
+                instruments_.errors->Add(values.errors, labelkv);
+            }
+            recordDurations(values.durations, labelkv);
+        }
+    }
+
+    /**
+     * Record one value per span into the SDK histogram: the exact min and
+     * max, and the mean of the rest of their bucket for the others. A mean
+     * of values from a bucket lies in that bucket, so bucket counts and the
+     * sum are those of the actual durations.
+     */
+    template <typename Attributes>
+    void recordDurations(const Durations& durations,
+                         const Attributes& attributes)
+    {
+        const opentelemetry::context::Context context;
+        bool min_recorded = false;
+        bool max_recorded = false;
+        for (std::size_t bucket = 0; bucket < durations.counts.size();
+             ++bucket)
+        {
+            auto count = durations.counts[bucket];
+            auto sum = durations.sums[bucket];
+            auto take = [&](bool& recorded, double value) {
+                if (recorded || count == 0 ||
+                    bucket != bucketOf(value))
+                {
+                    return;
+                }
+                instruments_.duration->Record(value, attributes, context);
+                recorded = true;
+                --count;
+                sum -= value;
+            };
+            take(min_recorded, durations.min);
+            take(max_recorded, durations.max);
+            if (count == 0)
+            {
+                continue;
+            }
+            const double mean = sum / static_cast<double>(count);
+            for (; count != 0; --count)
+            {
+                instruments_.duration->Record(mean, attributes, context);
+            }
+        }
+    }
+
+    std::size_t bucketOf(double value) const
+    {
+        const auto& boundaries = options_.duration_boundaries;
+        return static_cast<std::size_t>(
+            std::lower_bound(boundaries.begin(), boundaries.end(), value) -
+            boundaries.begin());
+    }
+
+    static void observeThreads(opentelemetry::metrics::ObserverResult result,
+                               void* state)
+    {
+        auto* self = static_cast<SpanMetricsProcessor*>(state);
+        {
+            // Skip the flush rather than wait on a thread that is flushing
+            // or replacing the instruments, which may be waiting for this
+            // collection
+            std::unique_lock<std::mutex> lock(self->instruments_lock_,
+                                              std::try_to_lock);
+            if (lock.owns_lock())
+            {
+                self->flushShards();
+            }
+        }
+        std::size_t threads = 0;
+        {
+            std::lock_guard<std::mutex> lock(self->registry_lock_);
+            threads = self->shards_.size();
+        }
+        opentelemetry::nostd::get<opentelemetry::nostd::shared_ptr<
+            opentelemetry::metrics::ObserverResultT<double>>>(result)
+            ->Observe(static_cast<double>(threads));
+    }
+
+    // Called with instruments_lock_ held
+    void refreshInstruments()
+    {
+        auto provider = opentelemetry::metrics::Provider::GetMeterProvider();
+        if (provider.get() == instruments_.provider)
+        {
+            return;
+        }
+        if (instruments_.threads)
+        {
+            instruments_.threads->RemoveCallback(observeThreads, this);
+        }
+        auto meter = provider->GetMeter(options_.prefix, "1.2.0");
+        instruments_.provider = provider.get();
+        instruments_.calls = meter->CreateUInt64Counter(
+            options_.prefix + "_calls", "Ended spans by span name");
+        instruments_.errors = meter->CreateUInt64Counter(
+            options_.prefix + "_errors",
+            "Ended spans with an error status by span name");
+        instruments_.duration = meter->CreateDoubleHistogram(
+            options_.prefix + "_duration", "Span duration by span name",
+            "ms");
+        instruments_.threads = meter->CreateDoubleObservableGauge(
+            options_.prefix + "_threads",
+            "Threads aggregating span metrics");
+        instruments_.threads->AddCallback(observeThreads, this);
+    }
+
+    static std::uint64_t nextId()
+    {
+        static std::atomic<std::uint64_t> id{0};
+        return ++id;
+    }
+
+    SpanMetricsOptions options_;
+    // Tells the thread local shard cache apart from other instances
+    const std::uint64_t id_;
+
+    std::mutex registry_lock_;
+    std::vector<std::shared_ptr<Shard>> shards_;
+
+    std::mutex instruments_lock_;
+    Instruments instruments_;
+};
+
+} // namespace bmctelemetry
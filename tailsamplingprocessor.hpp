@@ -0,0 +1,371 @@
+#pragma once
+
+#include "opentelemetry/sdk/trace/processor.h"
+#include "opentelemetry/sdk/trace/recordable.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace bmctelemetry
+{
+
+/**
+ * Struct to hold tail sampling options.
+ */
+struct TailSamplingOptions
+{
+    // Traces whose local root took at least this long are kept
+    std::chrono::milliseconds latency_threshold = std::chrono::milliseconds(100);
+    // Traces containing a span with an error status are kept
+    bool keep_errors = true;
+    // Hard cap on spans buffered for traces whose root has not ended yet
+    std::size_t max_buffered_spans = 4096;
+    // Traces whose root has not ended this long after their first span are
+    // given up on, e.g. because the root lives in another process
+    std::chrono::milliseconds max_trace_age = std::chrono::seconds(30);
+};
+
+/**
+ * Span processor that holds back the spans of a trace until its local root
+ * ends, then hands the whole trace to the next processor only if the root
+ * was slow or some span failed. Everything else is discarded.
+ *
+ * The recordables it creates wrap the next processor's recordables and
+ * remember just what the decision needs, so any exporter works underneath.
+ *
+ * A trace still pending after max_trace_age, or at Shutdown, is expired:
+ * its spans are passed on if one of them was slow or failed, and dropped
+ * otherwise.
+ */
+class TailSamplingSpanProcessor final :
+    public opentelemetry::sdk::trace::SpanProcessor
+{
+    using Recordable = opentelemetry::sdk::trace::Recordable;
+
+  public:
+    struct Stats
+    {
+        std::uint64_t kept_traces = 0;
+        std::uint64_t dropped_traces = 0;
+        // Spans discarded because max_buffered_spans was reached
+        std::uint64_t overflow_spans = 0;
+        // Traces whose root did not end within max_trace_age, or before
+        // Shutdown
+        std::uint64_t expired_traces = 0;
+    };
+
+    TailSamplingSpanProcessor(
+        std::unique_ptr<opentelemetry::sdk::trace::SpanProcessor> next,
+        const TailSamplingOptions& options = {}) :
+        next_(std::move(next)), options_(options)
+    {}
+
+    std::unique_ptr<Recordable> MakeRecordable() noexcept override
+    {
+        return std::make_unique<SampledRecordable>(next_->MakeRecordable());
+    }
+
+    void OnStart(Recordable& span,
+                 const opentelemetry::trace::SpanContext&
+                     parent_context) noexcept override
+    {
+        auto& recordable = static_cast<SampledRecordable&>(span);
+        recordable.local_root = !parent_context.IsValid() ||
+                                parent_context.IsRemote();
+        next_->OnStart(*recordable.inner, parent_context);
+    }
+
+    void OnEnd(std::unique_ptr<Recordable>&& span) noexcept override
+    {
+        std::unique_ptr<SampledRecordable> recordable(
+            static_cast<SampledRecordable*>(span.release()));
+        const bool interesting =
+            recordable->duration >= options_.latency_threshold ||
+            (options_.keep_errors && recordable->error);
+        const auto now = Clock::now();
+
+        Spans spans;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            expire(now, spans);
+            if (!recordable->local_root)
+            {
+                buffer(std::move(recordable), interesting, now);
+            }
+            else if (finish(*recordable, interesting, spans))
+            {
+                spans.push_back(std::move(recordable));
+            }
+        }
+        forward(spans);
+    }
+
+    /**
+     * Expire the traces past max_trace_age, then flush the next processor
+     */
+    bool ForceFlush(std::chrono::microseconds timeout =
+                        (std::chrono::microseconds::max)()) noexcept override
+    {
+        Spans spans;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            expire(Clock::now(), spans);
+        }
+        forward(spans);
+        return next_->ForceFlush(timeout);
+    }
+
+    /**
+     * Pass on the pending traces that already qualify, as if they had
+     * expired, and shut the next processor down
+     */
+    bool Shutdown(std::chrono::microseconds timeout =
+                      (std::chrono::microseconds::max)()) noexcept override
+    {
+        Spans spans;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            while (!traces_.empty())
+            {
+                ++stats_.expired_traces;
+                release(traces_.begin(), traces_.begin()->second.keep, spans);
+            }
+            arrivals_.clear();
+        }
+        forward(spans);
+        return next_->Shutdown(timeout);
+    }
+
+    Stats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+  private:
+    struct TraceKey
+    {
+        std::uint64_t high = 0;
+        std::uint64_t low = 0;
+        bool operator==(const TraceKey&) const = default;
+    };
+    struct TraceKeyHash
+    {
+        std::size_t operator()(const TraceKey& key) const noexcept
+        {
+            return static_cast<std::size_t>(key.high ^ (key.low * 31));
+        }
+    };
+
+    /**
+     * Forwards everything to the next processor's recordable and keeps the
+     * fields the sampling decision looks at
+     */
+    struct SampledRecordable final : Recordable
+    {
+        explicit SampledRecordable(std::unique_ptr<Recordable> recordable) :
+            inner(std::move(recordable))
+        {}
+
+        void SetIdentity(const opentelemetry::trace::SpanContext& span_context,
+                         opentelemetry::trace::SpanId
+                             parent_span_id) noexcept override
+        {
+            auto id = span_context.trace_id().Id();
+            std::memcpy(&trace.high, id.data(), sizeof(trace.high));
+            std::memcpy(&trace.low, id.data() + sizeof(trace.high),
+                        sizeof(trace.low));
+            inner->SetIdentity(span_context, parent_span_id);
+        }
+        void SetAttribute(
+            opentelemetry::nostd::string_view key,
+            const opentelemetry::common::AttributeValue& value) noexcept override
+        {
+            inner->SetAttribute(key, value);
+        }
+        void AddEvent(opentelemetry::nostd::string_view name,
+                      opentelemetry::common::SystemTimestamp timestamp,
+                      const opentelemetry::common::KeyValueIterable&
+                          attributes) noexcept override
+        {
+            inner->AddEvent(name, timestamp, attributes);
+        }
+        void AddLink(const opentelemetry::trace::SpanContext& span_context,
+                     const opentelemetry::common::KeyValueIterable&
+                         attributes) noexcept override
+        {
+            inner->AddLink(span_context, attributes);
+        }
+        void SetStatus(opentelemetry::trace::StatusCode code,
+                       opentelemetry::nostd::string_view
+                           description) noexcept override
+        {
+            error = code == opentelemetry::trace::StatusCode::kError;
+            inner->SetStatus(code, description);
+        }
+        void SetName(opentelemetry::nostd::string_view name) noexcept override
+        {
+            inner->SetName(name);
+        }
+        void SetSpanKind(
+            opentelemetry::trace::SpanKind span_kind) noexcept override
+        {
+            inner->SetSpanKind(span_kind);
+        }
+        void SetResource(const opentelemetry::sdk::resource::Resource&
+                             resource) noexcept override
+        {
+            inner->SetResource(resource);
+        }
+        void SetStartTime(
+            opentelemetry::common::SystemTimestamp start_time) noexcept override
+        {
+            inner->SetStartTime(start_time);
+        }
+        void SetDuration(std::chrono::nanoseconds span_duration) noexcept override
+        {
+            duration = span_duration;
+            inner->SetDuration(span_duration);
+        }
+        void SetInstrumentationScope(
+            const opentelemetry::sdk::instrumentationscope::InstrumentationScope&
+                instrumentation_scope) noexcept override
+        {
+            inner->SetInstrumentationScope(instrumentation_scope);
+        }
+
+        std::unique_ptr<Recordable> inner;
+        TraceKey trace;
+        std::chrono::nanoseconds duration{0};
+        bool error = false;
+        bool local_root = true;
+    };
+
+    using Clock = std::chrono::steady_clock;
+    using Spans = std::vector<std::unique_ptr<SampledRecordable>>;
+
+    struct PendingTrace
+    {
+        Spans spans;
+        bool keep = false;
+        // Tells the trace apart from a later one with the same id
+        std::uint64_t sequence = 0;
+    };
+    using TraceMap = std::unordered_map<TraceKey, PendingTrace, TraceKeyHash>;
+    struct Arrival
+    {
+        TraceKey trace;
+        std::uint64_t sequence = 0;
+        Clock::time_point time;
+    };
+
+    /**
+     * Hold a child span back until its local root ends. The cap is checked
+     * before a new trace is added, so overflow never grows traces_.
+     */
+    void buffer(std::unique_ptr<SampledRecordable> recordable,
+                bool interesting, Clock::time_point now)
+    {
+        auto it = traces_.find(recordable->trace);
+        if (buffered_ >= options_.max_buffered_spans)
+        {
+            if (it != traces_.end())
+            {
+                it->second.keep = it->second.keep || interesting;
+            }
+            ++stats_.overflow_spans;
+            return;
+        }
+        if (it == traces_.end())
+        {
+            it = traces_.try_emplace(recordable->trace).first;
+            it->second.sequence = ++sequence_;
+            arrivals_.push_back({recordable->trace, sequence_, now});
+        }
+        it->second.keep = it->second.keep || interesting;
+        it->second.spans.push_back(std::move(recordable));
+        ++buffered_;
+    }
+
+    /**
+     * Decide on the trace of a local root that just ended. Buffered spans
+     * of a kept trace are moved to `spans`.
+     *
+     * @return whether the root itself is kept
+     */
+    bool finish(const SampledRecordable& root, bool interesting, Spans& spans)
+    {
+        bool keep = interesting;
+        auto it = traces_.find(root.trace);
+        if (it != traces_.end())
+        {
+            keep = keep || it->second.keep;
+            release(it, keep, spans);
+        }
+        ++(keep ? stats_.kept_traces : stats_.dropped_traces);
+        return keep;
+    }
+
+    /**
+     * Give up on traces that have been pending for longer than
+     * max_trace_age. Arrivals are in time order, so the sweep stops at the
+     * first trace that is young enough.
+     */
+    void expire(Clock::time_point now, Spans& spans)
+    {
+        while (!arrivals_.empty() &&
+               now - arrivals_.front().time > options_.max_trace_age)
+        {
+            const auto arrival = arrivals_.front();
+            arrivals_.pop_front();
+            auto it = traces_.find(arrival.trace);
+            if (it == traces_.end() || it->second.sequence != arrival.sequence)
+            {
+                // Already decided by its root
+                continue;
+            }
+            ++stats_.expired_traces;
+            release(it, it->second.keep, spans);
+        }
+    }
+
+    void forward(Spans& spans) noexcept
+    {
+        for (auto& kept : spans)
+        {
+            next_->OnEnd(std::move(kept->inner));
+        }
+    }
+
+    void release(TraceMap::iterator it, bool keep, Spans& spans)
+    {
+        buffered_ -= it->second.spans.size();
+        if (keep)
+        {
+            std::move(it->second.spans.begin(), it->second.spans.end(),
+                      std::back_inserter(spans));
+        }
+        traces_.erase(it);
+    }
+
+    std::unique_ptr<opentelemetry::sdk::trace::SpanProcessor> next_;
+    TailSamplingOptions options_;
+
+    mutable std::mutex mutex_;
+    TraceMap traces_;
+    // When each pending trace got its first span, oldest first
+    std::deque<Arrival> arrivals_;
+    std::uint64_t sequence_ = 0;
+    std::size_t buffered_ = 0;
+    Stats stats_;
+};
+
+} // namespace bmctelemetry
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "opentelemetry/sdk/trace/sampler.h"
+#include "opentelemetry/sdk/trace/samplers/always_on_factory.h"
+#include "opentelemetry/sdk/trace/samplers/parent_factory.h"
+#include "opentelemetry/sdk/trace/samplers/trace_id_ratio_factory.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace bmctelemetry
+{
+
+/**
+ * Struct to hold head sampling options.
+ */
+struct SamplerOptions
+{
+    // Fraction of root traces sampled, by trace id
+    double ratio = 1.0;
+    // Follow the sampling decision of the parent span when there is one
+    bool parent_based = true;
+    // Spans sampled per second for each span name, 0 for no limit
+    std::uint32_t max_spans_per_second = 0;
+    // Apply max_spans_per_second to child spans too. When false only root
+    // spans are limited, so sampled traces are never cut in the middle.
+    bool rate_limit_children = true;
+};
+
+/**
+ * Sampler that lets at most `limit` spans of the same name per second
+ * through the decision of its delegate. Names are tracked by hash in a few
+ * independently locked shards, so concurrent spans of different names
+ * rarely contend.
+ */
+class RateLimitingSampler final : public opentelemetry::sdk::trace::Sampler
+{
+  public:
+    RateLimitingSampler(
+        std::unique_ptr<opentelemetry::sdk::trace::Sampler> delegate,
+        std::uint32_t limit) :
+        delegate_(std::move(delegate)), limit_(limit),
+        description_("RateLimitingSampler{" + std::to_string(limit) + "," +
+                     std::string(delegate_->GetDescription()) + "}")
+    {}
+
+    opentelemetry::sdk::trace::SamplingResult ShouldSample(
+        const opentelemetry::trace::SpanContext& parent_context,
+        opentelemetry::trace::TraceId trace_id,
+        opentelemetry::nostd::string_view name,
+        opentelemetry::trace::SpanKind span_kind,
+        const opentelemetry::common::KeyValueIterable& attributes,
+        const opentelemetry::trace::SpanContextKeyValueIterable&
+            links) noexcept override
+    {
+        auto result = delegate_->ShouldSample(parent_context, trace_id, name,
+                                              span_kind, attributes, links);
+        if (result.decision ==
+                opentelemetry::sdk::trace::Decision::RECORD_AND_SAMPLE &&
+            !acquire(name))
+        {
+            return {opentelemetry::sdk::trace::Decision::DROP, nullptr,
+                    result.trace_state};
+        }
+        return result;
+    }
+
+    opentelemetry::nostd::string_view GetDescription() const noexcept override
+    {
+        return description_;
+    }
+
+  private:
+    static constexpr std::size_t kShards = 16;
+
+    struct Window
+    {
+        std::int64_t second = 0;
+        std::uint32_t count = 0;
+    };
+    struct Shard
+    {
+        std::mutex lock;
+        std::unordered_map<std::size_t, Window> windows;
+    };
+
+    bool acquire(opentelemetry::nostd::string_view name) noexcept
+    {
+        auto hash = std::hash<std::string_view>{}(
+            std::string_view(name.data(), name.size()));
+        auto second = std::chrono::duration_cast<std::chrono::seconds>(
+                          std::chrono::steady_clock::now().time_since_epoch())
+                          .count();
+        auto& shard = shards_[hash % kShards];
+        std::lock_guard<std::mutex> lock(shard.lock);
+        auto& window = shard.windows[hash];
+        if (window.second != second)
+        {
+            window.second = second;
+            window.count = 0;
+        }
+        if (window.count >= limit_)
+        {
+            return false;
+        }
+        ++window.count;
+        return true;
+    }
+
+    std::unique_ptr<opentelemetry::sdk::trace::Sampler> delegate_;
+    std::uint32_t limit_;
+    std::string description_;
+    std::array<Shard, kShards> shards_;
+};
+
+/**
+ * Build the head sampler described by `options`. The rate limit sits outside
+ * the parent based sampler, so every span name is limited, unless
+ * rate_limit_children is off and it only limits root spans.
+ */
+inline std::unique_ptr<opentelemetry::sdk::trace::Sampler>
+    makeSampler(const SamplerOptions& options)
+{
+    namespace trace_sdk = opentelemetry::sdk::trace;
+    std::unique_ptr<trace_sdk::Sampler> sampler =
+        options.ratio >= 1.0
+            ? trace_sdk::AlwaysOnSamplerFactory::Create()
+            : trace_sdk::TraceIdRatioBasedSamplerFactory::Create(
+                  options.ratio);
+    const bool limit_roots_only =
+        options.parent_based && !options.rate_limit_children;
+    if (options.max_spans_per_second != 0 && limit_roots_only)
+    {
+        sampler = std::make_unique<RateLimitingSampler>(
+            std::move(sampler), options.max_spans_per_second);
+    }
+    if (options.parent_based)
+    {
+        sampler = trace_sdk::ParentBasedSamplerFactory::Create(
+            std::shared_ptr<trace_sdk::Sampler>(std::move(sampler)));
+    }
+    if (options.max_spans_per_second != 0 && !limit_roots_only)
+    {
+        sampler = std::make_unique<RateLimitingSampler>(
+            std::move(sampler), options.max_spans_per_second);
+    }
+    return sampler;
+}
+
+} // namespace bmctelemetry